@@ -3,7 +3,17 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Most sectors dispatched to a driver at once, after merging. */
+#define BLOCK_MERGE_MAX 128
+
+/* Ticks a request may wait before it is served ahead of the
+   elevator order. */
+#define BLOCK_DEADLINE (TIMER_FREQ / 2)
 
 /* A block device. */
 struct block
@@ -19,6 +29,12 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    struct list queue;                  /* Pending requests, oldest first. */
+    struct lock queue_lock;             /* Protects QUEUE and HEAD. */
+    struct condition queue_nonempty;    /* Signaled when a request arrives. */
+    block_sector_t head;                /* Sector after the last dispatched. */
+    bool worker_started;                /* Has the I/O thread been created? */
   };
 
 /* List of all block devices. */
@@ -28,6 +44,11 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void block_worker (void *block_);
+static void block_schedule (struct block *, struct list *batch);
+static void block_dispatch (struct block *, struct list *batch);
+static void block_transfer (struct block *, bool write, block_sector_t,
+                            size_t cnt, void *const buffers[]);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +141,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, &buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +152,279 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, &buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFERS[0], BUFFERS[1], and so on, each of which
+   must have room for BLOCK_SECTOR_SIZE bytes.  Drivers that can
+   do so transfer the whole run with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *const buffers[])
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, false, sector, cnt, buffers, NULL, NULL);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFERS[0], BUFFERS[1], and so on, each of which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block
+   device has acknowledged receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *const buffers[])
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, true, sector, cnt, (void *const *) buffers,
+                      NULL, NULL);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Initializes REQ to transfer the CNT sectors starting at SECTOR
+   between a block device and BUFFERS, writing to the device if
+   WRITE is true and reading from it otherwise.  If DONE is
+   non-null, it is called with REQ and AUX when the request
+   completes, in the device's I/O thread, and must not sleep;
+   otherwise the submitter waits for completion with
+   block_wait(). */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, size_t cnt, void *const buffers[],
+                    block_done_func *done, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffers = buffers;
+  req->done = done;
+  req->aux = aux;
+  sema_init (&req->completed, 0);
+}
+
+/* Queues REQ for BLOCK and returns without waiting for it.  The
+   device's I/O thread serves its queue in C-LOOK order, merging
+   requests for adjacent sectors, except that a request that has
+   waited BLOCK_DEADLINE ticks goes first. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  ASSERT (!intr_context ());
+
+  check_sector (block, req->sector);
+  check_sector (block, req->sector + req->cnt - 1);
+  if (req->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += req->cnt;
+    }
+  else
+    block->read_cnt += req->cnt;
+
+  if (block->ops->submit != NULL)
+    {
+      block->ops->submit (block->aux, req);
+      return;
+    }
+
+  req->deadline = timer_ticks () + BLOCK_DEADLINE;
+  lock_acquire (&block->queue_lock);
+  list_push_back (&block->queue, &req->elem);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  if (!block->worker_started)
+    {
+      block->worker_started = true;
+      if (thread_create (block->name, PRI_MAX, block_worker, block)
+          == TID_ERROR)
+        PANIC ("%s: can't create I/O thread", block->name);
+    }
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for REQ, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *req)
+{
+  ASSERT (req->done == NULL);
+  sema_down (&req->completed);
+}
+
+/* I/O thread for BLOCK: serves its queue forever. */
+static void
+block_worker (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct list batch;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      block_schedule (block, &batch);
+      lock_release (&block->queue_lock);
+
+      block_dispatch (block, &batch);
+    }
+}
+
+/* Moves the next requests to serve from BLOCK's queue into BATCH,
+   in sector order.  The first is the oldest request if its
+   deadline has passed, and otherwise the request nearest to the
+   head in the direction of increasing sectors, wrapping around
+   to the lowest one (C-LOOK).  It is joined by every queued
+   request in the same direction that extends the run at either
+   end, up to BLOCK_MERGE_MAX sectors.
+   Must be called with BLOCK's queue lock held. */
+static void
+block_schedule (struct block *block, struct list *batch)
+{
+  struct block_request *first, *lowest = NULL, *ahead = NULL;
+  block_sector_t start, end;
+  struct list_elem *e;
+  bool merged;
+
+  ASSERT (!list_empty (&block->queue));
+
+  first = list_entry (list_front (&block->queue), struct block_request, elem);
+  if (timer_ticks () < first->deadline)
+    {
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if (lowest == NULL || r->sector < lowest->sector)
+            lowest = r;
+          if (r->sector >= block->head
+              && (ahead == NULL || r->sector < ahead->sector))
+            ahead = r;
+        }
+      first = ahead != NULL ? ahead : lowest;
+    }
+
+  list_init (batch);
+  list_remove (&first->elem);
+  list_push_back (batch, &first->elem);
+  start = first->sector;
+  end = first->sector + first->cnt;
+
+  do
+    {
+      merged = false;
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if (r->write != first->write
+              || end - start + r->cnt > BLOCK_MERGE_MAX)
+            continue;
+          if (r->sector == end)
+            {
+              list_remove (&r->elem);
+              list_push_back (batch, &r->elem);
+              end += r->cnt;
+            }
+          else if (r->sector + r->cnt == start)
+            {
+              list_remove (&r->elem);
+              list_push_front (batch, &r->elem);
+              start = r->sector;
+            }
+          else
+            continue;
+          merged = true;
+          break;
+        }
+    }
+  while (merged);
+
+  block->head = end;
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFERS with a single driver call, if the driver allows. */
+static void
+block_transfer (struct block *block, bool write, block_sector_t sector,
+                size_t cnt, void *const buffers[])
+{
+  size_t i;
+
+  if (!write)
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i, buffers[i]);
+    }
+  else
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt,
+                                    (const void *const *) buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i, buffers[i]);
+    }
+}
+
+/* Transfers the requests in BATCH, which cover consecutive
+   sectors in order, in as few driver calls as possible, then
+   completes each of them. */
+static void
+block_dispatch (struct block *block, struct list *batch)
+{
+  struct block_request *first
+    = list_entry (list_front (batch), struct block_request, elem);
+  block_sector_t sector = first->sector;
+  void *buffers[BLOCK_MERGE_MAX];
+  size_t cnt = 0;
+  size_t i;
+  struct list_elem *e;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      for (i = 0; i < r->cnt; i++)
+        {
+          buffers[cnt++] = r->buffers[i];
+          if (cnt == BLOCK_MERGE_MAX)
+            {
+              block_transfer (block, first->write, sector, cnt, buffers);
+              sector += cnt;
+              cnt = 0;
+            }
+        }
+    }
+  if (cnt > 0)
+    block_transfer (block, first->write, sector, cnt, buffers);
+
+  while (!list_empty (batch))
+    {
+      struct block_request *r
+        = list_entry (list_pop_front (batch), struct block_request, elem);
+      if (r->done != NULL)
+        r->done (r, r->aux);
+      else
+        sema_up (&r->completed);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -200,6 +488,11 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  list_init (&block->queue);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_nonempty);
+  block->head = 0;
+  block->worker_started = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,18 +55,62 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *const buffers[]);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+struct block_request;
+typedef void block_done_func (struct block_request *, void *aux);
+
+/* A request to transfer CNT consecutive sectors starting at
+   SECTOR to or from BUFFERS, one buffer per sector.  The request
+   belongs to its submitter, who must not touch it or its buffers
+   until it completes. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in a device queue. */
+    bool write;                         /* Write if true, else read. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *const *buffers;               /* One buffer per sector. */
+    int64_t deadline;                   /* Dispatch by this tick. */
+    block_done_func *done;              /* Completion callback, or null. */
+    void *aux;                          /* Passed to DONE. */
+    struct semaphore completed;         /* Up'd on completion if no DONE. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *const buffers[],
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors in one go, to or from a separate buffer per sector.
+   They are optional: if null, READ or WRITE is called once per
+   sector instead.
+
+   SUBMIT is also optional.  If it is non-null, requests for the
+   device are passed to it instead of going through the device's
+   own queue, which lets a device forward them to another. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *const buffers[]);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *const buffers[]);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -8,7 +8,9 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +36,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +52,52 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors moved by one command.  The sector count register
+   is only 8 bits wide. */
+#define MAX_TRANSFER 128
+
+/* Most sectors per DRQ block that we ask for in SET MULTIPLE
+   MODE. */
+#define MAX_MULTIPLE 16
+
+/* PCI configuration space access. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Bus master IDE registers, relative to a channel's bus master
+   base port [SFF-8038i]. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of the PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_ST_ERR 0x02          /* Error; write 1 to clear. */
+#define BM_ST_INTR 0x04         /* Interrupt; write 1 to clear. */
+
+/* A physical region descriptor, one entry of a PRD table.  It
+   describes a physically contiguous buffer that does not cross a
+   64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+#define PRD_EOT 0x8000
+
+/* True to use bus master DMA where the controller supports it.
+   Controlled by kernel command-line option "-dma". */
+bool ide_dma;
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +106,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per READ/WRITE MULTIPLE DRQ
+                                   block, or 0 if not enabled. */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +123,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, or 0 if no DMA. */
+    struct prd *prdt;           /* PRD table for DMA, one page. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,8 +139,14 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static uint16_t find_bus_master (void);
+static void setup_dma (struct channel *, uint16_t bm_base);
+static void set_multiple_mode (struct ata_disk *, int max);
+
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *const buffers[], bool write);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -101,6 +161,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void)
 {
+  uint16_t bm_base = ide_dma ? find_bus_master () : 0;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +187,7 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      setup_dma (c, bm_base != 0 ? bm_base + chan_no * 8 : 0);
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +198,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +218,58 @@ ide_init (void)
     }
 }
 
+/* Returns the bus master base port of the first PCI IDE
+   controller that can do bus master DMA, after enabling bus
+   mastering on it, or 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t addr = 0x80000000 | (dev << 11) | (func << 8);
+        uint32_t class, bar4;
+
+        outl (PCI_CONFIG_ADDR, addr);
+        if ((inl (PCI_CONFIG_DATA) & 0xffff) == 0xffff)
+          continue;
+
+        /* Mass storage (0x01), IDE (0x01), bus master capable. */
+        outl (PCI_CONFIG_ADDR, addr | 0x08);
+        class = inl (PCI_CONFIG_DATA);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        outl (PCI_CONFIG_ADDR, addr | 0x20);
+        bar4 = inl (PCI_CONFIG_DATA);
+        if (!(bar4 & 1))
+          continue;
+
+        /* Enable I/O space access and bus mastering. */
+        outl (PCI_CONFIG_ADDR, addr | 0x04);
+        outl (PCI_CONFIG_DATA, inl (PCI_CONFIG_DATA) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Prepares channel C for bus master DMA through the registers at
+   BM_BASE.  DMA stays disabled if BM_BASE is 0 or no memory is
+   available for the PRD table. */
+static void
+setup_dma (struct channel *c, uint16_t bm_base)
+{
+  c->bm_base = 0;
+  c->prdt = NULL;
+  if (bm_base == 0)
+    return;
+  c->prdt = palloc_get_page (0);
+  if (c->prdt != NULL)
+    c->bm_base = bm_base;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -303,12 +418,43 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 gives the most sectors per DRQ block that READ
+     MULTIPLE and WRITE MULTIPLE support. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Enables READ MULTIPLE and WRITE MULTIPLE on disk D with the
+   largest power of 2 sectors per DRQ block, up to MAX and
+   MAX_MULTIPLE, that the disk accepts.  Leaves them disabled if
+   MAX is 0. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  for (cnt = MAX_MULTIPLE; cnt > 1; cnt /= 2)
+    {
+      if (cnt > max)
+        continue;
+      select_device_wait (d);
+      outb (reg_nsect (c), cnt);
+      issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+      sema_down (&c->completion_wait);
+      wait_while_busy (d);
+      if (!(inb (reg_alt_status (c)) & STA_ERR))
+        {
+          d->multiple = cnt;
+          return;
+        }
+    }
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +483,212 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFERS, each of which must have room for BLOCK_SECTOR_SIZE
+   bytes.  Uses one DMA command per MAX_TRANSFER sectors if DMA is
+   enabled, and otherwise one PIO command, with an interrupt per
+   DRQ block of sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+      size_t per_drq = d->multiple > 0 ? d->multiple : 1;
+      size_t i;
+
+      if (!dma_transfer (d, sec_no, n, buffers, false))
+        {
+          select_sector (d, sec_no, n);
+          issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                                : CMD_READ_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              if (i % per_drq == 0)
+                {
+                  sema_down (&c->completion_wait);
+                  if (!wait_while_busy (d))
+                    PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                           d->name, sec_no + i);
+                }
+              input_sector (c, buffers[i]);
+            }
+        }
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFERS, each of which must contain BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Uses DMA or multi-sector PIO commands as ide_read_multiple()
+   does.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+      size_t per_drq = d->multiple > 0 ? d->multiple : 1;
+      size_t i;
+
+      if (!dma_transfer (d, sec_no, n, (void *const *) buffers, true))
+        {
+          select_sector (d, sec_no, n);
+          issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                                : CMD_WRITE_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              if (i % per_drq == 0 && !wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, buffers[i]);
+              if (i % per_drq == per_drq - 1 || i == n - 1)
+                sema_down (&c->completion_wait);
+            }
+        }
+
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, &buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, &buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
-
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFERS by bus master DMA, reading from the disk unless
+   WRITE is true.  Returns false, without transferring anything,
+   if D's channel is not set up for DMA.  If the transfer fails,
+   disables DMA on the channel and also returns false, so that
+   the caller falls back to PIO.
+   D's channel must be locked. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *const buffers[], bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t bm_cmd = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status, status;
+  size_t i, n = 0;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (cnt <= MAX_TRANSFER);
+
+  if (c->bm_base == 0)
+    return false;
+
+  /* Describe the buffers, merging physically adjacent ones and
+     splitting any that straddle a 64 kB boundary. */
+  for (i = 0; i < cnt; i++)
+    {
+      uint32_t addr = vtop (buffers[i]);
+      uint32_t left = BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          uint32_t room = 0x10000 - (addr & 0xffff);
+          uint32_t len = left < room ? left : room;
+          struct prd *last = n > 0 ? &c->prdt[n - 1] : NULL;
+
+          if (last != NULL && last->addr + last->size == addr
+              && (last->addr & 0xffff) + last->size + len < 0x10000)
+            last->size += len;
+          else
+            {
+              c->prdt[n].addr = addr;
+              c->prdt[n].size = len;
+              c->prdt[n].flags = 0;
+              n++;
+            }
+          addr += len;
+          left -= len;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+
+  select_sector (d, sec_no, cnt);
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  outb (c->bm_base + BM_COMMAND, bm_cmd);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (c->bm_base + BM_COMMAND, bm_cmd | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  outb (c->bm_base + BM_COMMAND, bm_cmd);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BM_ST_ERR) || (status & STA_ERR))
+    {
+      printf ("%s: DMA failed, sector=%"PRDSNu", falling back to PIO\n",
+              d->name, sec_no);
+      c->bm_base = 0;
+      return false;
+    }
+  return true;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection and count
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= 256);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
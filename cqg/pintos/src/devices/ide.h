@@ -1,6 +1,10 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+extern bool ide_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
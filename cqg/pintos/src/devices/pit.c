@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,34 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts channel 0 counting down from COUNT in mode 0
+   ("interrupt on terminal count"), so that a single timer
+   interrupt is raised COUNT PIT cycles from now.  Must be
+   called with interrupts off. */
+void
+pit_start_oneshot (uint16_t count)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (count >= 2);
+
+  outb (PIT_PORT_CONTROL, 0x30);
+  outb (PIT_PORT_COUNTER (0), count);
+  outb (PIT_PORT_COUNTER (0), count >> 8);
+}
+
+/* Latches and returns channel 0's current count.  In mode 0 the
+   counter keeps counting down past 0, wrapping to 0xffff.  Must
+   be called with interrupts off. */
+uint16_t
+pit_read_count (void)
+{
+  uint8_t low, high;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  outb (PIT_PORT_CONTROL, 0x00);
+  low = inb (PIT_PORT_COUNTER (0));
+  high = inb (PIT_PORT_COUNTER (0));
+  return low | (high << 8);
+}
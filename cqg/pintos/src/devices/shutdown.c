@@ -12,6 +12,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
+#endif
+#ifdef VM
+#include "vm/swap.h"
 #endif
 
 /* Keyboard control register port. */
@@ -132,6 +136,10 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+#endif
+#ifdef VM
+  swap_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
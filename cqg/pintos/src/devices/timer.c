@@ -20,6 +20,58 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Pending timers, kept in a hierarchical timing wheel.  Level 0
+   has one slot per tick; each higher level has slots that cover
+   a whole turn of the level below it.  A timer sits in the
+   lowest level whose range still reaches its expiry tick and is
+   moved down ("cascaded") when its slot comes up, so each tick
+   only looks at the one level-0 slot that is due, plus one slot
+   per level every time a lower level wraps around. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)    /* Slots per level. */
+#define WHEEL_LEVELS 4                  /* Covers 2**24 ticks. */
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Next tick that the wheel has not processed yet. */
+static int64_t wheel_ticks;
+
+/* Tickless mode, enabled by the kernel command-line option
+   "-tickless".  Instead of interrupting at TIMER_FREQ, channel 0
+   is armed in one-shot mode for the next moment the CPU is
+   needed: the next tick while a thread runs, the next due timer
+   while the CPU is idle, or the deadline of a sub-tick sleep.
+   Time is then kept in PIT cycles, and ticks are derived from
+   it, possibly several at once after an idle stretch. */
+bool timer_tickless;
+
+#define CYCLES_PER_TICK (PIT_HZ / TIMER_FREQ)
+
+/* Bounds on a one-shot period, in PIT cycles.  The upper bound
+   stays below half the 16-bit counter so that a latched count
+   that has wrapped past terminal count can be told apart from
+   one still counting down. */
+#define ONESHOT_MIN 16
+#define ONESHOT_MAX 0x8000
+
+/* PIT cycles from boot to the start of the current one-shot
+   period, and the count that period was started with. */
+static int64_t clock_cycles;
+static uint16_t oneshot_count;
+
+/* # of timer interrupts taken in tickless mode. */
+static int64_t oneshot_interrupts;
+
+/* A thread blocked in a sub-tick sleep. */
+struct hr_sleeper
+  {
+    struct list_elem elem;      /* Element in hr_sleepers. */
+    int64_t deadline;           /* Wake-up time in PIT cycles. */
+    struct thread *thread;      /* Sleeping thread. */
+  };
+
+/* Sub-tick sleepers, soonest deadline first. */
+static struct list hr_sleepers;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -30,12 +82,39 @@ static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
 static void real_time_sleep(int64_t num, int32_t denom);
 static void real_time_delay(int64_t num, int32_t denom);
+static void wheel_insert(struct timer *);
+static void wheel_cascade(int level);
+static void wheel_run(void);
+static void wake_thread(void *t_);
+static int64_t wheel_next_due(void);
+static int64_t clock_now(void);
+static void oneshot_arm(int64_t now, int64_t deadline);
+static void oneshot_rearm(int64_t deadline);
+static void tickless_interrupt(void);
+static void hr_sleep(int64_t cycles);
+static bool hr_sleeper_less(const struct list_elem *, const struct list_elem *,
+                            void *aux);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void timer_init(void)
 {
-  pit_configure_channel(0, 2, TIMER_FREQ);
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init(&wheel[level][slot]);
+  wheel_ticks = 0;
+  list_init(&hr_sleepers);
+
+  if (timer_tickless)
+  {
+    enum intr_level old_level = intr_disable();
+    oneshot_arm(0, CYCLES_PER_TICK);
+    intr_set_level(old_level);
+  }
+  else
+    pit_configure_channel(0, 2, TIMER_FREQ);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -87,19 +166,16 @@ timer_elapsed(int64_t then)
    be turned on. */
 void timer_sleep(int64_t ticks)
 {
-  // int64_t start = timer_ticks ();
+  struct timer timer;
 
-  // ASSERT (intr_get_level () == INTR_ON);
-  // while (timer_elapsed (start) < ticks)
-  //   thread_yield ();
   if (ticks <= 0)
   {
     return;
   }
   ASSERT(intr_get_level() == INTR_ON);
   enum intr_level old_level = intr_disable();
-  struct thread *current_thread = thread_current();
-  current_thread->blocking_ticks = ticks;
+  timer_init_timer(&timer, wake_thread, thread_current());
+  timer_add(&timer, timer_ticks() + ticks);
   thread_block();
   intr_set_level(old_level);
 }
@@ -165,15 +241,291 @@ void timer_ndelay(int64_t ns)
 void timer_print_stats(void)
 {
   printf("Timer: %" PRId64 " ticks\n", timer_ticks());
+  if (timer_tickless)
+    printf("Timer: %" PRId64 " one-shot interrupts\n", oneshot_interrupts);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  In tickless mode, pushes the next interrupt out to the
+   next tick at which a timer is due, so that an idle CPU is not
+   woken up on every tick. */
+void timer_idle_enter(void)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+  if (timer_tickless)
+    oneshot_rearm(wheel_next_due() * CYCLES_PER_TICK);
+}
+
+/* Called when the CPU switches away from the idle thread.  In
+   tickless mode, pulls the next interrupt back to the next tick
+   boundary so that the new thread's time slice is enforced. */
+void timer_idle_exit(void)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+  if (timer_tickless)
+    oneshot_rearm((ticks + 1) * CYCLES_PER_TICK);
+}
+
+/* Initializes TIMER to call FUNC with AUX when it expires.  The
+   timer is not armed until timer_add() is called. */
+void timer_init_timer(struct timer *timer, timer_func *func, void *aux)
+{
+  ASSERT(timer != NULL);
+  ASSERT(func != NULL);
+
+  timer->func = func;
+  timer->aux = aux;
+  timer->pending = false;
+}
+
+/* Arms TIMER to fire at tick EXPIRES, as returned by
+   timer_ticks().  A tick that has already passed fires on the
+   next timer interrupt.  TIMER must not be pending. */
+void timer_add(struct timer *timer, int64_t expires)
+{
+  enum intr_level old_level = intr_disable();
+  ASSERT(!timer->pending);
+  timer->expires = expires;
+  timer->pending = true;
+  wheel_insert(timer);
+  intr_set_level(old_level);
+}
+
+/* Disarms TIMER.  Returns true if it was pending, false if it
+   had already fired or was never armed.  Once this returns,
+   TIMER's function will not be called. */
+bool timer_cancel(struct timer *timer)
+{
+  enum intr_level old_level = intr_disable();
+  bool was_pending = timer->pending;
+  if (was_pending)
+  {
+    list_remove(&timer->elem);
+    timer->pending = false;
+  }
+  intr_set_level(old_level);
+  return was_pending;
+}
+
+/* Puts pending TIMER into the wheel slot for its expiry tick.
+   Must be called with interrupts off. */
+static void
+wheel_insert(struct timer *timer)
+{
+  int64_t expires = timer->expires;
+  int64_t delta;
+  int level;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (expires < wheel_ticks)
+    expires = wheel_ticks;
+  delta = expires - wheel_ticks;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+  {
+    /* Beyond the wheel's range: park it in the furthest slot,
+       and let cascading place it again later. */
+    expires = wheel_ticks + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+  }
+  list_push_back(&wheel[level][(expires >> (WHEEL_BITS * level))
+                               & (WHEEL_SIZE - 1)],
+                 &timer->elem);
+}
+
+/* Re-inserts the timers of the LEVEL slot that wheel_ticks has
+   just reached, moving them to lower levels.  Cascades the next
+   level too when this one wraps around. */
+static void
+wheel_cascade(int level)
+{
+  int slot = (wheel_ticks >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+  struct list timers;
+
+  if (slot == 0 && level + 1 < WHEEL_LEVELS)
+    wheel_cascade(level + 1);
+
+  list_init(&timers);
+  while (!list_empty(&wheel[level][slot]))
+    list_push_back(&timers, list_pop_front(&wheel[level][slot]));
+  while (!list_empty(&timers))
+    wheel_insert(list_entry(list_pop_front(&timers), struct timer, elem));
+}
+
+/* Fires every timer due up to the current tick. */
+static void
+wheel_run(void)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  while (wheel_ticks <= ticks)
+  {
+    struct list *slot = &wheel[0][wheel_ticks & (WHEEL_SIZE - 1)];
+
+    if ((wheel_ticks & (WHEEL_SIZE - 1)) == 0)
+      wheel_cascade(1);
+    while (!list_empty(slot))
+    {
+      struct timer *timer = list_entry(list_pop_front(slot),
+                                       struct timer, elem);
+      timer->pending = false;
+      timer->func(timer->aux);
+    }
+    wheel_ticks++;
+  }
+}
+
+/* Returns the first tick from wheel_ticks on at which the wheel
+   has work: a non-empty level-0 slot or a cascade. */
+static int64_t
+wheel_next_due(void)
+{
+  int64_t t;
+
+  for (t = wheel_ticks;; t++)
+    if ((t & (WHEEL_SIZE - 1)) == 0
+        || !list_empty(&wheel[0][t & (WHEEL_SIZE - 1)]))
+      return t;
+}
+
+/* Returns the number of PIT cycles since boot.  Must be called
+   with interrupts off, in tickless mode. */
+static int64_t
+clock_now(void)
+{
+  uint16_t count = pit_read_count();
+
+  /* Past terminal count, the interrupt is pending and the counter
+     has wrapped and kept counting down from 0xffff.  ONESHOT_MAX
+     leaves room for the overrun to be told apart from a count
+     still running. */
+  if (count > oneshot_count)
+    return clock_cycles + oneshot_count + (uint16_t) (0 - count);
+  return clock_cycles + (oneshot_count - count);
+}
+
+/* Starts a one-shot period at NOW, in PIT cycles, that ends at
+   DEADLINE or at the first sub-tick sleeper's deadline,
+   whichever is earlier, within the PIT's limits. */
+static void
+oneshot_arm(int64_t now, int64_t deadline)
+{
+  int64_t count;
+
+  if (!list_empty(&hr_sleepers))
+  {
+    struct hr_sleeper *s = list_entry(list_front(&hr_sleepers),
+                                      struct hr_sleeper, elem);
+    if (s->deadline < deadline)
+      deadline = s->deadline;
+  }
+
+  count = deadline - now;
+  if (count < ONESHOT_MIN)
+    count = ONESHOT_MIN;
+  else if (count > ONESHOT_MAX)
+    count = ONESHOT_MAX;
+
+  clock_cycles = now;
+  oneshot_count = count;
+  pit_start_oneshot(count);
+}
+
+/* Cuts the current one-shot period short, or extends it, so that
+   the next interrupt comes at DEADLINE.  Does nothing if the
+   period has already expired, since the pending interrupt will
+   arm the next one itself. */
+static void
+oneshot_rearm(int64_t deadline)
+{
+  uint16_t count = pit_read_count();
+
+  if (count <= oneshot_count)
+    oneshot_arm(clock_cycles + (oneshot_count - count), deadline);
+}
+
+/* Timer interrupt in tickless mode: accounts for every tick that
+   went by during the period that just ended, and since then while
+   the interrupt waited to be handled, then arms the next one. */
+static void
+tickless_interrupt(void)
+{
+  int64_t now = clock_now();
+
+  oneshot_interrupts++;
+  while ((ticks + 1) * CYCLES_PER_TICK <= now)
+  {
+    ticks++;
+    thread_timer(ticks % TIMER_FREQ == 0);
+    thread_tick();
+  }
+  wheel_run();
+
+  while (!list_empty(&hr_sleepers))
+  {
+    struct hr_sleeper *s = list_entry(list_front(&hr_sleepers),
+                                      struct hr_sleeper, elem);
+    if (s->deadline > now)
+      break;
+    list_pop_front(&hr_sleepers);
+    thread_unblock(s->thread);
+  }
+
+  oneshot_arm(now, (ticks + 1) * CYCLES_PER_TICK);
+}
+
+/* Blocks the running thread for CYCLES PIT cycles, using a
+   one-shot interrupt at the deadline rather than a busy wait.
+   Tickless mode only. */
+static void
+hr_sleep(int64_t cycles)
+{
+  struct hr_sleeper s;
+  enum intr_level old_level;
+
+  ASSERT(timer_tickless);
+  ASSERT(intr_get_level() == INTR_ON);
+
+  old_level = intr_disable();
+  s.deadline = clock_now() + cycles;
+  s.thread = thread_current();
+  list_insert_ordered(&hr_sleepers, &s.elem, hr_sleeper_less, NULL);
+  oneshot_rearm((ticks + 1) * CYCLES_PER_TICK);
+  thread_block();
+  intr_set_level(old_level);
+}
+
+/* Orders sub-tick sleepers by deadline. */
+static bool
+hr_sleeper_less(const struct list_elem *a, const struct list_elem *b,
+                void *aux UNUSED)
+{
+  return list_entry(a, struct hr_sleeper, elem)->deadline
+         < list_entry(b, struct hr_sleeper, elem)->deadline;
+}
+
+/* Timer function used by timer_sleep(): wakes up thread T_. */
+static void
+wake_thread(void *t_)
+{
+  thread_unblock(t_);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt(struct intr_frame *args UNUSED)
 {
+  if (timer_tickless)
+  {
+    tickless_interrupt();
+    return;
+  }
   ticks++;
   enum intr_level old_level = intr_disable();
   thread_timer(timer_ticks() % TIMER_FREQ == 0);
+  wheel_run();
   intr_set_level(old_level);
   thread_tick ();
   // ticks++;
@@ -249,6 +601,12 @@ real_time_sleep(int64_t num, int32_t denom)
          processes. */
     timer_sleep(ticks);
   }
+  else if (timer_tickless)
+  {
+    /* Sub-tick sleep: block until a one-shot interrupt fires at
+       the deadline. */
+    hr_sleep(num * PIT_HZ / denom);
+  }
   else
   {
     /* Otherwise, use a busy-wait loop for more accurate
@@ -4,146 +4,560 @@
 
 #include <lib/stdbool.h>
 #include <string.h>
+#include <stdlib.h>
 #include <lib/stdio.h>
+#include <hash.h>
 #include <devices/timer.h>
 #include "cache.h"
 #include "filesys.h"
 #include "../threads/synch.h"
+#include "../threads/thread.h"
 
 #define CACHE_SIZE 64
+#define READ_AHEAD_QUEUE 64     /* Max pending read-ahead requests. */
+#define FLUSH_PERIOD TIMER_FREQ /* Ticks between write-behind passes. */
+#define READ_AHEAD_BATCH 16     /* Max adjacent sectors prefetched at once. */
 
+/* A cached sector.
+
+   The sector index, the clock hand and every PIN_CNT are
+   protected by lock_cache_all, which is only held for short
+   bookkeeping and never across disk I/O.  BUF and DIRTY are
+   protected by the block's own LOCK.  The thread that brings a
+   sector in from disk holds LOCK for the whole transfer, so a
+   reader that finds the block while its I/O is still in flight
+   simply waits on LOCK.
+
+   PIN_CNT counts the threads that are using, or waiting to use,
+   the block.  Pinned blocks are never evicted, and an unpinned
+   block's LOCK is never held by anybody.  A thread that holds
+   more than one block at a time must take them in a fixed order
+   (index tables before the sectors they point to, the free map's
+   blocks last) to keep the per-block locks free of deadlock. */
 struct cache_block
   {
     unsigned char buf[BLOCK_SECTOR_SIZE];
     block_sector_t sector_idx;
-    int accessed;
+    struct hash_elem hash_elem;         /* Element in cache_index. */
+    struct lock lock;                   /* Protects BUF and DIRTY. */
+    int pin_cnt;                        /* Threads using this block. */
+    bool accessed;
     bool dirty;
     bool used;
+    bool prefetched;                    /* Read ahead, not yet demanded. */
   };
 
-int cache_get_free_cache (void);
+static struct cache_block *cache_get_free_cache (bool wait);
+static struct cache_block *cache_lookup (block_sector_t sector);
+static struct cache_block *cache_bind (block_sector_t sector, bool prefetch,
+                                       bool *missp);
+static void cache_prefetch (block_sector_t first, size_t cnt);
+static void read_ahead_thread (void *aux UNUSED);
+static void write_behind_thread (void *aux UNUSED);
+static size_t flush_pass (struct cache_block **busyp);
+static void flush_unpin (struct cache_block **set, size_t cnt);
+static int cache_sector_cmp (const void *, const void *);
+static unsigned cache_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool cache_less (const struct hash_elem *a, const struct hash_elem *b,
+                        void *aux UNUSED);
 
 static struct cache_block cache[CACHE_SIZE];
-//struct lock locks_cache[CACHE_SIZE];
+static struct hash cache_index;         /* Sector -> cache_block. */
 static struct lock lock_cache_all;
+static struct condition cache_unpinned; /* Signaled when a pin drops to 0. */
+
+static int current_cache;
+
+/* Statistics, protected by lock_cache_all. */
+static unsigned long long hit_cnt;      /* Demand accesses found cached. */
+static unsigned long long miss_cnt;     /* Demand accesses read from disk. */
+static unsigned long long prefetch_cnt; /* Sectors brought in by read-ahead. */
+static unsigned long long prefetch_hit_cnt;    /* ...later demanded. */
+static unsigned long long prefetch_wasted_cnt; /* ...evicted unused. */
 
-int cnt_used, current_cache;
+/* Sectors queued for the read-ahead thread, in a ring buffer. */
+static block_sector_t ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head;                  /* Index of the oldest request. */
+static size_t ra_cnt;                   /* Number of queued requests. */
+static struct lock ra_lock;             /* Protects the queue. */
+static struct condition ra_nonempty;    /* Signaled when a request arrives. */
 
-int cache_get_free_cache ()
+/* State of cache_flush(), protected by flush_lock. */
+static struct lock flush_lock;
+static struct cache_block *flush_set[CACHE_SIZE];  /* Blocks to write. */
+static uint8_t flush_buf[CACHE_SIZE][BLOCK_SECTOR_SIZE]; /* Staged data. */
+static void *flush_bufs[CACHE_SIZE];    /* Pointers into flush_buf. */
+static struct block_request flush_reqs[CACHE_SIZE]; /* One per run. */
+
+/* Chooses a block to hold a new sector, advancing the clock
+   hand past recently accessed blocks.  Only unpinned blocks are
+   considered; if every block is pinned, waits for one to be
+   released.  Clean blocks are preferred, since the write-behind
+   thread keeps most blocks clean, but if the clock finds no clean
+   victim the returned block may still be used and dirty.  If
+   every block is pinned and WAIT is false, returns a null pointer
+   instead of waiting.
+   Must be called with lock_cache_all held. */
+static struct cache_block *
+cache_get_free_cache (bool wait)
 {
-  if (cnt_used == 0)
+  struct cache_block *b, *dirty_victim;
+  int scanned;
+
+  ASSERT (lock_held_by_current_thread (&lock_cache_all));
+
+  for (;;)
     {
-      current_cache = 1;
-      return 0;
+      dirty_victim = NULL;
+      for (scanned = 0; scanned < 2 * CACHE_SIZE; scanned++)
+        {
+          b = &cache[current_cache];
+          current_cache = (current_cache + 1) % CACHE_SIZE;
+          if (b->pin_cnt > 0)
+            continue;
+          if (!b->used)
+            return b;
+          if (b->accessed)
+            b->accessed = false;
+          else if (!b->dirty)
+            return b;
+          else if (dirty_victim == NULL)
+            dirty_victim = b;
+        }
+      if (dirty_victim != NULL || !wait)
+        return dirty_victim;
+      cond_wait (&cache_unpinned, &lock_cache_all);
     }
-  while (cache[current_cache].used && cache[current_cache].accessed)
+}
+
+/* Returns the block caching SECTOR, or a null pointer if SECTOR
+   is not cached.  Must be called with lock_cache_all held. */
+static struct cache_block *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_block key;
+  struct hash_elem *e;
+
+  key.sector_idx = sector;
+  e = hash_find (&cache_index, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_block, hash_elem) : NULL;
+}
+
+/* Does the work for cache_get(), except for reading SECTOR from
+   disk: returns the block for SECTOR, pinned and locked, and sets
+   *MISSP to true if its contents still have to be read in.
+
+   If PREFETCH is true, this is a speculative read on behalf of
+   the read-ahead thread.  Then nothing is done, and a null
+   pointer is returned, if SECTOR is already cached or every
+   block is pinned.  Otherwise the block is marked as prefetched,
+   so that the first demand access to it can be counted. */
+static struct cache_block *
+cache_bind (block_sector_t sector, bool prefetch, bool *missp)
+{
+  struct cache_block *b;
+
+  lock_acquire (&lock_cache_all);
+  for (;;)
     {
-      //lock_acquire (&locks_cache[current_cache]);
-      cache[current_cache].accessed = 0;
-      //lock_release (&locks_cache[current_cache]);
-      current_cache = (current_cache + 1) % CACHE_SIZE;
+      b = cache_lookup (sector);
+      if (b != NULL)
+        {
+          if (prefetch)
+            {
+              lock_release (&lock_cache_all);
+              return NULL;
+            }
+
+          /* Hit.  If the block's I/O is still in flight, its
+             owner holds the lock and we wait for it here. */
+          hit_cnt++;
+          if (b->prefetched)
+            {
+              b->prefetched = false;
+              prefetch_hit_cnt++;
+            }
+          b->pin_cnt++;
+          b->accessed = true;
+          lock_release (&lock_cache_all);
+          lock_acquire (&b->lock);
+          *missp = false;
+          return b;
+        }
+
+      b = cache_get_free_cache (!prefetch);
+      if (b == NULL)
+        {
+          lock_release (&lock_cache_all);
+          return NULL;
+        }
+      if (!b->used || !b->dirty)
+        break;
+
+      /* The victim is dirty.  Write it back with only the victim
+         pinned, so it stays findable under its old sector and
+         nobody rereads stale data from disk meanwhile, then look
+         again: SECTOR may have been brought in by now. */
+      b->pin_cnt++;
+      lock_release (&lock_cache_all);
+      lock_acquire (&b->lock);
+      if (b->dirty)
+        {
+          block_write (fs_device, b->sector_idx, b->buf);
+          b->dirty = false;
+        }
+      lock_release (&b->lock);
+      lock_acquire (&lock_cache_all);
+      if (--b->pin_cnt == 0)
+        cond_signal (&cache_unpinned, &lock_cache_all);
     }
-  //lock_acquire (&locks_cache[current_cache]);
-  if (cache[current_cache].used && cache[current_cache].dirty)
+
+  /* Rebind the clean victim to SECTOR.  It was unpinned, so
+     nobody holds its lock and taking it here cannot block. */
+  if (b->used)
     {
-      block_write (fs_device, cache[current_cache].sector_idx, cache[current_cache].buf);
+      if (b->prefetched)
+        prefetch_wasted_cnt++;
+      hash_delete (&cache_index, &b->hash_elem);
     }
-  if (cache[current_cache].used)
+  if (prefetch)
+    prefetch_cnt++;
+  else
+    miss_cnt++;
+  b->sector_idx = sector;
+  b->used = true;
+  b->accessed = true;
+  b->dirty = false;
+  b->prefetched = prefetch;
+  b->pin_cnt = 1;
+  hash_insert (&cache_index, &b->hash_elem);
+  lock_acquire (&b->lock);
+  lock_release (&lock_cache_all);
+
+  *missp = true;
+  return b;
+}
+
+/* Returns the block that caches SECTOR, pinned and locked for
+   the caller, who must release it with cache_put() and may access
+   its contents through cache_data() until then.  On a miss,
+   evicts a victim and reads SECTOR from disk unless INTENT is
+   CACHE_OVERWRITE; neither the victim's write-back nor the read
+   is done while holding lock_cache_all.  Any intent other than
+   CACHE_READ marks the block dirty. */
+struct cache_block *
+cache_get (block_sector_t sector, enum cache_intent intent)
+{
+  bool miss;
+  struct cache_block *b = cache_bind (sector, false, &miss);
+
+  if (miss && intent != CACHE_OVERWRITE)
+    block_read (fs_device, sector, b->buf);
+  if (intent != CACHE_READ)
+    b->dirty = true;
+  return b;
+}
+
+/* Brings the CNT sectors starting at FIRST into the cache as
+   prefetched blocks.  Each run of them that is not cached yet is
+   read with a single multi-sector transfer. */
+static void
+cache_prefetch (block_sector_t first, size_t cnt)
+{
+  struct cache_block *run[READ_AHEAD_BATCH];
+  void *bufs[READ_AHEAD_BATCH];
+  size_t n = 0;
+  size_t i, k;
+
+  ASSERT (cnt <= READ_AHEAD_BATCH);
+
+  for (i = 0; i <= cnt; i++)
     {
-      cache[current_cache].used = false;
-      --cnt_used;
+      struct cache_block *b = NULL;
+      bool miss;
+
+      if (i < cnt)
+        b = cache_bind (first + i, true, &miss);
+      if (b != NULL)
+        {
+          run[n] = b;
+          bufs[n] = b->buf;
+          n++;
+          continue;
+        }
+
+      /* Sector I is cached, or we are done: read the run so far. */
+      block_read_multiple (fs_device, first + i - n, n, bufs);
+      for (k = 0; k < n; k++)
+        cache_put (run[k]);
+      n = 0;
     }
-  //lock_release (&locks_cache[current_cache]);
-  int ret = current_cache;
-  current_cache = (current_cache + 1) % CACHE_SIZE;
-  return ret;
+}
+
+/* Returns the BLOCK_SECTOR_SIZE bytes of data cached in B, which
+   must have been returned by cache_get() and not yet put back. */
+void *
+cache_data (struct cache_block *b)
+{
+  ASSERT (lock_held_by_current_thread (&b->lock));
+  return b->buf;
+}
+
+/* Unlocks and unpins B, which was returned by cache_get(). */
+void
+cache_put (struct cache_block *b)
+{
+  lock_release (&b->lock);
+  lock_acquire (&lock_cache_all);
+  if (--b->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &lock_cache_all);
+  lock_release (&lock_cache_all);
 }
 
 void cache_init ()
 {
   lock_init (&lock_cache_all);
-  cnt_used = 0;
-  current_cache = -1;
+  cond_init (&cache_unpinned);
+  if (!hash_init (&cache_index, cache_hash, cache_less, NULL))
+    PANIC ("cache: can't allocate the sector index");
+  current_cache = 0;
   for (int i = 0; i < CACHE_SIZE; ++i)
     {
-      cache[i].dirty = cache[i].used = false;
-      cache[i].accessed = 0;
+      cache[i].dirty = cache[i].used = cache[i].accessed = false;
+      cache[i].prefetched = false;
+      cache[i].pin_cnt = 0;
       memset (cache[i].buf, 0, BLOCK_SECTOR_SIZE);
-      //lock_init (&locks_cache[i]);
+      lock_init (&cache[i].lock);
     }
+
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  ra_head = ra_cnt = 0;
+  lock_init (&flush_lock);
+  for (int i = 0; i < CACHE_SIZE; ++i)
+    flush_bufs[i] = flush_buf[i];
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_thread, NULL);
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_thread, NULL);
 }
 
 void cache_read (block_sector_t sector, void *buffer)
 {
-  lock_acquire (&lock_cache_all);
-  bool found = false;
-  for (int i = 0; i < CACHE_SIZE; ++i)
-    if (cache[i].used && cache[i].sector_idx == sector)
-      {
-        //lock_acquire (&locks_cache[i]);
-        memcpy (buffer, cache[i].buf, BLOCK_SECTOR_SIZE);
-        ++cache[i].accessed;
-        //lock_release (&locks_cache[i]);
-        found = true;
-        lock_release (&lock_cache_all);
-        break;
-      }
-  if (found)
-    return;
-  int index = cache_get_free_cache ();
-  ++cnt_used;
-  //lock_acquire (&locks_cache[index]);
-  cache[index].sector_idx = sector;
-  cache[index].dirty = false;
-  cache[index].used = true;
-  cache[index].accessed = 1;
-  block_read (fs_device, sector, cache[index].buf);
-  memcpy (buffer, cache[index].buf, BLOCK_SECTOR_SIZE);
-  //lock_release (&locks_cache[index]);
-  lock_release (&lock_cache_all);
+  struct cache_block *b = cache_get (sector, CACHE_READ);
+  memcpy (buffer, b->buf, BLOCK_SECTOR_SIZE);
+  cache_put (b);
 }
 
 void cache_write (block_sector_t sector, const void *buffer)
 {
+  struct cache_block *b = cache_get (sector, CACHE_OVERWRITE);
+  memcpy (b->buf, buffer, BLOCK_SECTOR_SIZE);
+  cache_put (b);
+}
+
+void cache_done ()
+{
+  cache_flush ();
+}
+
+/* Drops the pins flush_pass() holds on the CNT blocks starting at
+   SET. */
+static void
+flush_unpin (struct cache_block **set, size_t cnt)
+{
+  size_t i;
+
   lock_acquire (&lock_cache_all);
-  bool found = false;
-  for (int i = 0; i < CACHE_SIZE; ++i)
-    if (cache[i].used && cache[i].sector_idx == sector)
-      {
-        //lock_acquire (&locks_cache[i]);
-        memcpy (cache[i].buf, buffer, BLOCK_SECTOR_SIZE);
-        cache[i].dirty = true;
-        ++cache[i].accessed;
-        //lock_release (&locks_cache[i]);
-        found = true;
-        lock_release (&lock_cache_all);
-        break;
-      }
-  if (found)
-    return;
-  int index = cache_get_free_cache ();
-  ++cnt_used;
-  //lock_acquire (&locks_cache[index]);
-  cache[index].sector_idx = sector;
-  cache[index].dirty = true;
-  cache[index].used = true;
-  cache[index].accessed = 1;
-  memcpy(cache[index].buf, buffer, BLOCK_SECTOR_SIZE);
-  //lock_release (&locks_cache[index]);
+  for (i = 0; i < cnt; i++)
+    if (--set[i]->pin_cnt == 0)
+      cond_signal (&cache_unpinned, &lock_cache_all);
   lock_release (&lock_cache_all);
 }
 
-void cache_done ()
+/* Writes back the dirty blocks that are not locked by anybody.
+   Each block is copied into its own slot of flush_buf while
+   locked, so writers are not held up by the I/O.  Every run of
+   adjacent sectors is then submitted as one asynchronous request,
+   all at once, so that the device queue can order them.  A block
+   stays pinned until its run is written, so that it cannot be
+   evicted and reread from disk before then.
+
+   A busy block is skipped rather than waited for: its holder may
+   be waiting in cache_get_free_cache() for one of the blocks
+   pinned here.  Returns the number of dirty blocks skipped.  If
+   BUSYP is not null, one of them stays pinned and is stored into
+   *BUSYP, and the caller must unpin it.
+   Must be called with flush_lock held. */
+static size_t
+flush_pass (struct cache_block **busyp)
 {
+  size_t cnt = 0, kept = 0, skipped = 0, req_cnt = 0;
+  size_t i, j;
+
   lock_acquire (&lock_cache_all);
-  for (int i = 0; i < CACHE_SIZE; ++i)
+  for (i = 0; i < CACHE_SIZE; i++)
     if (cache[i].used && cache[i].dirty)
       {
-        //lock_acquire (&locks_cache[i]);
-        block_write (fs_device, cache[i].sector_idx, cache[i].buf);
-        cache[i].used = false;
-        //lock_release (&locks_cache[i]);
-        --cnt_used;
+        cache[i].pin_cnt++;
+        flush_set[cnt++] = &cache[i];
       }
   lock_release (&lock_cache_all);
+
+  qsort (flush_set, cnt, sizeof *flush_set, cache_sector_cmp);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_block *b = flush_set[i];
+      if (!lock_try_acquire (&b->lock))
+        {
+          if (busyp == NULL)
+            flush_unpin (&b, 1);
+          else
+            {
+              if (skipped > 0)
+                flush_unpin (busyp, 1);
+              *busyp = b;
+            }
+          skipped++;
+          continue;
+        }
+      memcpy (flush_bufs[kept], b->buf, BLOCK_SECTOR_SIZE);
+      b->dirty = false;
+      lock_release (&b->lock);
+      flush_set[kept++] = b;
+    }
+
+  for (i = 0; i < kept; i = j)
+    {
+      block_sector_t first = flush_set[i]->sector_idx;
+
+      for (j = i; j < kept && flush_set[j]->sector_idx == first + (j - i); j++)
+        continue;
+      block_request_init (&flush_reqs[req_cnt], true, first, j - i,
+                          &flush_bufs[i], NULL, NULL);
+      block_submit (fs_device, &flush_reqs[req_cnt++]);
+    }
+
+  /* Runs were submitted in order, so request I covers the blocks
+     from the start of run I. */
+  for (i = 0, j = 0; i < req_cnt; i++)
+    {
+      block_wait (&flush_reqs[i]);
+      flush_unpin (&flush_set[j], flush_reqs[i].cnt);
+      j += flush_reqs[i].cnt;
+    }
+  return skipped;
+}
+
+/* Writes every dirty block back to disk, retrying the ones that
+   were busy until none is left.  Between passes, waits for the
+   holder of a busy block to release it, pinning only that block:
+   waiting on its lock donates our priority to the holder, and the
+   pin keeps the block from being evicted while its lock is held,
+   which cache_bind() relies on. */
+void
+cache_flush (void)
+{
+  struct cache_block *busy;
+
+  lock_acquire (&flush_lock);
+  while (flush_pass (&busy) > 0)
+    {
+      lock_acquire (&busy->lock);
+      lock_release (&busy->lock);
+      flush_unpin (&busy, 1);
+    }
+  lock_release (&flush_lock);
+}
+
+/* Flushes dirty blocks every FLUSH_PERIOD ticks, forever. */
+static void
+write_behind_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_PERIOD);
+      lock_acquire (&flush_lock);
+      flush_pass (NULL);
+      lock_release (&flush_lock);
+    }
+}
+
+/* Orders pointers to cache blocks by sector number, for qsort(). */
+static int
+cache_sector_cmp (const void *a_, const void *b_)
+{
+  const struct cache_block *a = *(struct cache_block *const *) a_;
+  const struct cache_block *b = *(struct cache_block *const *) b_;
+
+  return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  The request is dropped if the queue is full. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < READ_AHEAD_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Serves read-ahead requests, oldest first, forever. */
+static void
+read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t first;
+      size_t cnt = 0;
+
+      /* Take the oldest request along with any that follow it on
+         disk, so that they can be read as one run. */
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      first = ra_queue[ra_head];
+      do
+        {
+          ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+          ra_cnt--;
+          cnt++;
+        }
+      while (ra_cnt > 0 && cnt < READ_AHEAD_BATCH
+             && ra_queue[ra_head] == first + cnt);
+      lock_release (&ra_lock);
+
+      cache_prefetch (first, cnt);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses; "
+          "read-ahead: %llu sectors, %llu hits, %llu wasted\n",
+          hit_cnt, miss_cnt, prefetch_cnt, prefetch_hit_cnt,
+          prefetch_wasted_cnt);
+}
+
+/* Hashes a cache block by its sector number. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_block *b = hash_entry (e, struct cache_block, hash_elem);
+  return hash_int (b->sector_idx);
+}
+
+/* Orders cache blocks by sector number. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct cache_block, hash_elem)->sector_idx
+         < hash_entry (b, struct cache_block, hash_elem)->sector_idx;
 }
@@ -7,9 +7,25 @@
 
 #include "devices/block.h"
 
+/* How the caller of cache_get() is going to use the block. */
+enum cache_intent
+  {
+    CACHE_READ,                 /* Only read the data. */
+    CACHE_WRITE,                /* Modify part of the data. */
+    CACHE_OVERWRITE             /* Replace all of it; skip the disk read. */
+  };
+
+struct cache_block;
+
 void cache_init (void);
+struct cache_block *cache_get (block_sector_t sector, enum cache_intent);
+void *cache_data (struct cache_block *);
+void cache_put (struct cache_block *);
 void cache_read (block_sector_t sector, void *buffer);
 void cache_write (block_sector_t sector, const void *buffer);
+void cache_read_ahead (block_sector_t sector);
+void cache_flush (void);
 void cache_done (void);
+void cache_print_stats (void);
 
 #endif /* filesys/cache.h */
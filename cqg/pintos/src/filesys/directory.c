@@ -4,6 +4,7 @@
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
 #include "filesys/free-map.h"
 #include "filesys/file.h"
@@ -108,23 +109,63 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
+  struct cache_block *b = NULL;
+  off_t b_ofs = 0;
+  off_t length;
   size_t ofs;
+  bool found = false;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  /* Entries are compared in place in the cache.  The rare entry
+     that straddles two sectors is read through inode_read_at(). */
+  length = inode_length (dir->inode);
+  for (ofs = 0; ofs + sizeof (struct dir_entry) <= (size_t) length;
+       ofs += sizeof (struct dir_entry))
+    {
+      size_t sector_ofs = ofs % BLOCK_SECTOR_SIZE;
+      const struct dir_entry *e;
+      struct dir_entry straddler;
+
+      if (sector_ofs + sizeof *e <= BLOCK_SECTOR_SIZE)
+        {
+          if (b == NULL || b_ofs != (off_t) (ofs - sector_ofs))
+            {
+              if (b != NULL)
+                cache_put (b);
+              b_ofs = ofs - sector_ofs;
+              b = cache_get (inode_get_sector (dir->inode, b_ofs), CACHE_READ);
+            }
+          e = (const struct dir_entry *) ((uint8_t *) cache_data (b)
+                                          + sector_ofs);
+        }
+      else
+        {
+          if (b != NULL)
+            {
+              cache_put (b);
+              b = NULL;
+            }
+          if (inode_read_at (dir->inode, &straddler, sizeof straddler, ofs)
+              != sizeof straddler)
+            break;
+          e = &straddler;
+        }
+
+      if (e->in_use && !strcmp (name, e->name)) 
+        {
+          if (ep != NULL)
+            *ep = *e;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          found = true;
+          break;
+        }
+    }
+  if (b != NULL)
+    cache_put (b);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -140,10 +181,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock_dir (dir->inode);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
@@ -168,8 +211,10 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use, and that the directory has not
+     been removed while we were getting here. */
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
@@ -210,6 +255,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
         }
     }
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
@@ -228,6 +274,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  inode_lock_dir (dir->inode);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -246,6 +293,7 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -257,17 +305,37 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  inode_lock_dir (dir->inode);
   while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e)
   {
     dir->pos += sizeof e;
     if (e.in_use)
     {
       strlcpy(name, e.name, NAME_MAX + 1);
-      return true;
+      found = true;
+      break;
     }
   }
-  return false;
+  inode_unlock_dir (dir->inode);
+  return found;
+}
+
+/* Returns true if directory INODE has no entries besides "." and
+   "..".  Must be called with INODE's directory lock held. */
+static bool
+dir_is_empty (struct inode *inode)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  for (ofs = DIR_BASE_ENTRY * sizeof e;
+       inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use)
+      return false;
+  return true;
 }
 
 
@@ -329,23 +397,16 @@ subdir_delete(struct dir* current_dir, char* subdir_name)
     inode_close(inode);
     return false;
   }
-  if (inode_get_opencnt(inode) > 1)
-  {
-    inode_close(inode);
-    return false;
-  }
-  struct dir* dir_copy = dir_open(inode);
-  char* buffer = malloc(NAME_MAX + 1);
-  ASSERT(buffer != NULL)
-  if (dir_readdir(dir_copy, buffer))
-  {
-    dir_close(dir_copy);
-    free(buffer);
-    return false;
-  }
-  dir_close(dir_copy);
-  free(buffer);
-  return dir_remove(current_dir, subdir_name);
+  /* Hold the directory's lock from the checks to the removal, so
+     that nothing can be added to it in between.  Locks are always
+     taken from child to parent, never the other way around. */
+  inode_lock_dir(inode);
+  bool success = (inode_get_opencnt(inode) == 1
+                  && dir_is_empty(inode)
+                  && dir_remove(current_dir, subdir_name));
+  inode_unlock_dir(inode);
+  inode_close(inode);
+  return success;
 }
 
 bool
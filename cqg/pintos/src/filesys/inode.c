@@ -9,22 +9,64 @@
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
-/* Identifies an inode. */
+/* Identify an inode and its format: a two-level table of
+   sectors, or a list of extents. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4f45
 #define TABLE_SIZE 128
 
-static char zeros[BLOCK_SECTOR_SIZE];
-static char empty[BLOCK_SECTOR_SIZE];
+/* Extents stored in the inode itself and in each overflow block. */
+#define DIRECT_EXTENTS 60
+#define OVERFLOW_EXTENTS 63
+
+/* Sectors allocated beyond the end of a growing file, so that a
+   file written a little at a time still ends up contiguous.  The
+   slack is given back when the file is closed. */
+#define EXTENT_PREALLOC 16
+
+/* Number of second-level index tables kept in a `struct inode'. */
+#define T2_CACHE_SIZE 4
+
+/* Read-ahead window bounds, in sectors. */
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 32
+
+/* A run of LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   An INODE_MAGIC inode maps its data through TABLE.  An
+   INODE_EXTENT_MAGIC inode maps it through EXTENT_CNT extents, in
+   file order, the first DIRECT_EXTENTS of which are stored here
+   and the rest in a chain of overflow blocks starting at
+   OVERFLOW. */
 struct inode_disk
   {
     block_sector_t table;               /* Table data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
     bool is_dir;
-    uint8_t unused[499];               /* Not used. */
+    uint8_t unused[3];                  /* Not used. */
+    uint32_t alloc_cnt;                 /* Sectors allocated to extents. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t overflow;            /* First overflow block, or -1. */
+    struct extent extents[DIRECT_EXTENTS];
+    uint8_t unused2[4];                 /* Not used. */
+  };
+
+/* An overflow block of extents.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next overflow block, or -1. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[OVERFLOW_EXTENTS];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -35,15 +77,47 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* A second-level index table kept in memory. */
+struct t2_table
+  {
+    off_t t1_idx;                       /* Index in first-level table, or -1. */
+    block_sector_t *entries;            /* TABLE_SIZE entries, or null. */
+  };
+
+/* In-memory inode.
+
+   ELEM, OPEN_CNT, LOADING and CLOSING are protected by
+   open_inodes_lock.  LOADING is set while the first opener reads
+   the inode in, and CLOSING while the last closer trims it, both
+   outside that lock; other openers wait on CLOSED until neither
+   is set.  RW is
+   held for reading while data is read or written within the
+   current length, and for writing while the inode grows or
+   DENY_WRITE_CNT changes, so reads and writes of different
+   files, and reads of the same file, go on in parallel.
+   DIR_LOCK is only used by directories, to keep their entries
+   consistent (see directory.c). */
 struct inode 
   {
     struct list_elem elem;              /* Element in inode list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Being read in by its opener? */
+    bool closing;                       /* Being trimmed by its closer? */
+    struct condition closed;            /* Signaled when either ends. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Protects DATA and DENY_WRITE_CNT. */
+    struct lock dir_lock;               /* Serializes directory updates. */
     struct inode_disk data;             /* Inode content. */
+    struct lock ra_lock;                /* Protects the RA_* members. */
+    off_t ra_next;                      /* Where a sequential read goes on. */
+    off_t ra_end;                       /* End of data queued to read ahead. */
+    int ra_window;                      /* Read-ahead window, in sectors. */
+    struct lock tables_lock;            /* Protects the resident tables. */
+    block_sector_t *t1;                 /* First-level table, or null. */
+    bool t1_loaded;                     /* True if T1 holds the table. */
+    struct t2_table t2[T2_CACHE_SIZE];  /* Second-level tables, MRU first. */
   };
 
 /* Map the pos into tables
@@ -61,93 +135,474 @@ byte_to_t2(off_t pos)
   return (pos >> 9) & (TABLE_SIZE - 1);
 }
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Fills SECTOR with copies of BYTE, directly in the cache. */
+static void
+fill_sector (block_sector_t sector, int byte)
+{
+  struct cache_block *b = cache_get (sector, CACHE_OVERWRITE);
+  memset (cache_data (b), byte, BLOCK_SECTOR_SIZE);
+  cache_put (b);
+}
 
+/* Returns entry IDX of the index table stored in sector TABLE. */
 static block_sector_t
-byte_to_sector (struct inode *inode, off_t pos, bool create) 
+table_lookup (block_sector_t table, off_t idx)
 {
-  ASSERT (inode != NULL);
-  
-  block_sector_t *t1 = calloc(TABLE_SIZE, sizeof *t1);
-  block_sector_t *t2 = calloc(TABLE_SIZE, sizeof *t2);
+  struct cache_block *b = cache_get (table, CACHE_READ);
+  block_sector_t sector = ((block_sector_t *) cache_data (b))[idx];
+  cache_put (b);
+  return sector;
+}
 
-  if (!(pos < inode->data.length))
+/* Returns INODE's resident copy of the second-level table found
+   at index T1_IDX of its first-level table, reading the tables it
+   needs from the cache.  INODE->t2 is kept in most recently used
+   order and a miss replaces its last table.  Returns a null
+   pointer if memory runs out.  Must be called with
+   INODE->tables_lock held. */
+static block_sector_t *
+inode_t2_table (struct inode *inode, off_t t1_idx)
+{
+  struct t2_table t2;
+  int i;
+
+  if (!inode->t1_loaded)
+    {
+      if (inode->t1 == NULL && (inode->t1 = malloc (BLOCK_SECTOR_SIZE)) == NULL)
+        return NULL;
+      cache_read (inode->data.table, inode->t1);
+      inode->t1_loaded = true;
+    }
+
+  /* Find the table, or else fall through to the LRU slot. */
+  for (i = 0; i < T2_CACHE_SIZE - 1; i++)
+    if (inode->t2[i].t1_idx == t1_idx)
+      break;
+  t2 = inode->t2[i];
+  if (t2.t1_idx != t1_idx)
     {
-      if (!create)
+      if (t2.entries == NULL)
         {
-          free(t1);
-          free(t2);
-          return -1;
+          t2.entries = malloc (BLOCK_SECTOR_SIZE);
+          if (t2.entries == NULL)
+            return NULL;
         }
-      else
+      cache_read (inode->t1[t1_idx], t2.entries);
+      t2.t1_idx = t1_idx;
+    }
+
+  memmove (&inode->t2[1], &inode->t2[0], i * sizeof *inode->t2);
+  inode->t2[0] = t2;
+  return t2.entries;
+}
+
+/* Discards INODE's resident index tables, which must be done
+   whenever the tables on disk change, but keeps their buffers. */
+static void
+inode_invalidate_tables (struct inode *inode)
+{
+  int i;
+
+  lock_acquire (&inode->tables_lock);
+  inode->t1_loaded = false;
+  for (i = 0; i < T2_CACHE_SIZE; i++)
+    inode->t2[i].t1_idx = -1;
+  lock_release (&inode->tables_lock);
+}
+
+/* Returns true if D maps its data through extents. */
+static inline bool
+is_extent_inode (const struct inode_disk *d)
+{
+  return d->magic == INODE_EXTENT_MAGIC;
+}
+
+/* Returns the overflow block of D that holds extent IDX, which
+   must be at least DIRECT_EXTENTS. */
+static block_sector_t
+overflow_block (const struct inode_disk *d, uint32_t idx)
+{
+  block_sector_t sector = d->overflow;
+  uint32_t blk;
+
+  for (blk = (idx - DIRECT_EXTENTS) / OVERFLOW_EXTENTS; blk > 0; blk--)
+    {
+      struct cache_block *b = cache_get (sector, CACHE_READ);
+      sector = ((struct extent_block *) cache_data (b))->next;
+      cache_put (b);
+    }
+  return sector;
+}
+
+/* Sets the link to the overflow block that would hold extent IDX
+   of D to NEXT. */
+static void
+overflow_link (struct inode_disk *d, uint32_t idx, block_sector_t next)
+{
+  struct cache_block *b;
+
+  if (idx == DIRECT_EXTENTS)
+    {
+      d->overflow = next;
+      return;
+    }
+  b = cache_get (overflow_block (d, idx - 1), CACHE_WRITE);
+  ((struct extent_block *) cache_data (b))->next = next;
+  cache_put (b);
+}
+
+/* Returns true if extent IDX is the first one of an overflow
+   block. */
+static inline bool
+starts_overflow_block (uint32_t idx)
+{
+  return idx >= DIRECT_EXTENTS && (idx - DIRECT_EXTENTS) % OVERFLOW_EXTENTS == 0;
+}
+
+/* Copies extent IDX of D into *E. */
+static void
+extent_get (const struct inode_disk *d, uint32_t idx, struct extent *e)
+{
+  struct cache_block *b;
+
+  ASSERT (idx < d->extent_cnt);
+  if (idx < DIRECT_EXTENTS)
+    {
+      *e = d->extents[idx];
+      return;
+    }
+  b = cache_get (overflow_block (d, idx), CACHE_READ);
+  *e = ((struct extent_block *) cache_data (b))
+         ->extents[(idx - DIRECT_EXTENTS) % OVERFLOW_EXTENTS];
+  cache_put (b);
+}
+
+/* Stores *E as extent IDX of D. */
+static void
+extent_put (struct inode_disk *d, uint32_t idx, const struct extent *e)
+{
+  struct cache_block *b;
+
+  ASSERT (idx < d->extent_cnt);
+  if (idx < DIRECT_EXTENTS)
+    {
+      d->extents[idx] = *e;
+      return;
+    }
+  b = cache_get (overflow_block (d, idx), CACHE_WRITE);
+  ((struct extent_block *) cache_data (b))
+    ->extents[(idx - DIRECT_EXTENTS) % OVERFLOW_EXTENTS] = *e;
+  cache_put (b);
+}
+
+/* Adds *E after the last extent of D, allocating a new overflow
+   block if needed.  Returns false if that allocation fails. */
+static bool
+extent_append (struct inode_disk *d, const struct extent *e)
+{
+  uint32_t idx = d->extent_cnt;
+
+  if (starts_overflow_block (idx))
+    {
+      block_sector_t sector;
+      struct cache_block *b;
+      struct extent_block *eb;
+
+      if (!free_map_allocate (1, &sector))
+        return false;
+      b = cache_get (sector, CACHE_OVERWRITE);
+      eb = cache_data (b);
+      memset (eb, 0, sizeof *eb);
+      eb->next = -1;
+      cache_put (b);
+      overflow_link (d, idx, sector);
+    }
+  d->extent_cnt++;
+  extent_put (d, idx, e);
+  return true;
+}
+
+/* Returns the sector holding sector OFS of the data of D, or -1
+   if D has fewer sectors than that allocated. */
+static block_sector_t
+extent_to_sector (const struct inode_disk *d, size_t ofs)
+{
+  block_sector_t sector;
+  uint32_t i = 0;
+
+  for (; i < d->extent_cnt && i < DIRECT_EXTENTS; i++)
+    {
+      if (ofs < d->extents[i].length)
+        return d->extents[i].start + ofs;
+      ofs -= d->extents[i].length;
+    }
+
+  for (sector = d->overflow; i < d->extent_cnt; )
+    {
+      struct cache_block *b = cache_get (sector, CACHE_READ);
+      const struct extent_block *eb = cache_data (b);
+      uint32_t j;
+
+      for (j = 0; j < OVERFLOW_EXTENTS && i < d->extent_cnt; i++, j++)
         {
-          off_t i, j;
-          off_t t1_s = byte_to_t1(inode->data.length);
-          off_t t2_s = byte_to_t2(inode->data.length);
-          off_t t1_t = byte_to_t1(pos);
-          off_t t2_t = byte_to_t2(pos);
-          
-          cache_read (inode->data.table, t1);
-          for (i = t1_s; i <= t1_t; i++)
+          if (ofs < eb->extents[j].length)
             {
-              off_t l = (i == t1_s ? t2_s : 0);
-              off_t r = (i == t1_t ? t2_t : TABLE_SIZE - 1);
-              
-              if (t1[i] == -1)
-                {
-                  if (!free_map_allocate (1, &t1[i]))
-                  {
-                    free(t1);
-                    free(t2);
-                    return -1;
-                  }
-                  cache_write (t1[i], empty);
-                }
-                
-              cache_read (t1[i], t2);
-              for(j = l; j <= r; j++)
-                {
-                  if (t2[j] == -1)
-                    {
-                      if (!free_map_allocate (1, &t2[j])) {
-                        free(t1);
-                        free(t2);
-                        return -1;
-                      }
-                      cache_write (t2[j], zeros);
-                    }
-                }
-              cache_write (t1[i], t2);
+              sector = eb->extents[j].start + ofs;
+              cache_put (b);
+              return sector;
             }
-          cache_write (inode->data.table, t1);
-          
-          inode->data.length = pos + 1;
-          cache_write (inode->sector, &inode->data);
+          ofs -= eb->extents[j].length;
         }
+      sector = eb->next;
+      cache_put (b);
     }
-  
-  cache_read (inode->data.table, t1);
-  cache_read (t1[byte_to_t1 (pos)], t2);
-  block_sector_t result = t2[byte_to_t2 (pos)];
-  
-  free(t1);
-  free(t2);
-  return result;
+  return -1;
+}
+
+/* Makes sure that at least WANT sectors are allocated to D, and
+   tries for SLACK more.  New sectors extend the last extent when
+   the sectors after it are free, and otherwise start a new extent
+   that is as long as the free map allows.
+   Returns false if the disk is too full for WANT sectors. */
+static bool
+extent_allocate (struct inode_disk *d, size_t want, size_t slack)
+{
+  size_t goal = want + slack;
+
+  if (d->alloc_cnt >= want)
+    return true;
+
+  while (d->alloc_cnt < goal)
+    {
+      size_t need = goal - d->alloc_cnt;
+      struct extent e;
+      size_t cnt = 0;
+
+      if (d->extent_cnt > 0)
+        {
+          extent_get (d, d->extent_cnt - 1, &e);
+          cnt = free_map_extend (e.start + e.length, need);
+          if (cnt > 0)
+            {
+              e.length += cnt;
+              extent_put (d, d->extent_cnt - 1, &e);
+            }
+        }
+      if (cnt == 0)
+        {
+          cnt = free_map_allocate_run (need, &e.start);
+          if (cnt == 0)
+            break;
+          e.length = cnt;
+          if (!extent_append (d, &e))
+            {
+              free_map_release (e.start, cnt);
+              break;
+            }
+        }
+      d->alloc_cnt += cnt;
+    }
+  return d->alloc_cnt >= want;
+}
+
+/* Gives back every sector of D past the first KEEP, along with
+   any overflow blocks that are left empty. */
+static void
+extent_truncate (struct inode_disk *d, size_t keep)
+{
+  while (d->alloc_cnt > keep)
+    {
+      uint32_t idx = d->extent_cnt - 1;
+      struct extent e;
+      size_t drop;
+
+      extent_get (d, idx, &e);
+      drop = d->alloc_cnt - keep;
+      if (drop > e.length)
+        drop = e.length;
+      e.length -= drop;
+      free_map_release (e.start + e.length, drop);
+      d->alloc_cnt -= drop;
+      if (e.length > 0)
+        {
+          extent_put (d, idx, &e);
+          break;
+        }
+
+      if (starts_overflow_block (idx))
+        {
+          free_map_release (overflow_block (d, idx), 1);
+          overflow_link (d, idx, -1);
+        }
+      d->extent_cnt--;
+    }
+}
+
+/* Zeroes sectors FIRST up to LAST of the data of D, except for
+   sectors SKIP_FIRST up to SKIP_LAST.  Walks the extents once
+   rather than looking up each sector on its own. */
+static void
+extent_zero (const struct inode_disk *d, size_t first, size_t last,
+             size_t skip_first, size_t skip_last)
+{
+  size_t ofs = 0;
+  uint32_t i;
+
+  for (i = 0; i < d->extent_cnt && ofs < last; i++)
+    {
+      struct extent e;
+      size_t s;
+
+      extent_get (d, i, &e);
+      for (s = ofs > first ? ofs : first; s < ofs + e.length && s < last; s++)
+        if (s < skip_first || s >= skip_last)
+          fill_sector (e.start + (s - ofs), 0);
+      ofs += e.length;
+    }
+}
+
+/* Sets the length of D, which must not shrink, to LENGTH bytes,
+   allocating sectors as needed plus SLACK more if possible.  The
+   caller is about to write the bytes from WRITTEN up to LENGTH,
+   so only the new sectors that write leaves partly covered are
+   zeroed.
+   Returns false if the disk is full. */
+static bool
+extent_resize (struct inode_disk *d, off_t length, size_t slack,
+               off_t written)
+{
+  size_t have = bytes_to_sectors (d->length);
+  size_t want = bytes_to_sectors (length);
+
+  ASSERT (length >= d->length);
+  ASSERT (written <= length);
+
+  if (!extent_allocate (d, want, slack))
+    return false;
+  extent_zero (d, have, want, bytes_to_sectors (written),
+               length / BLOCK_SECTOR_SIZE);
+  d->length = length;
+  return true;
+}
+
+/* Extends table-mapped INODE so that it contains byte offset
+   POS, allocating every missing table and data sector up to POS.
+   The tables are updated in place in the cache.  Holding them
+   across free_map_allocate() is safe because the free map's own
+   blocks are always the last ones taken.
+   Returns false if disk allocation fails. */
+static bool
+table_grow (struct inode *inode, off_t pos)
+{
+  off_t i, j;
+  off_t t1_s = byte_to_t1(inode->data.length);
+  off_t t2_s = byte_to_t2(inode->data.length);
+  off_t t1_t = byte_to_t1(pos);
+  off_t t2_t = byte_to_t2(pos);
+  struct cache_block *b1, *b2;
+  block_sector_t *t1, *t2;
+  bool success = true;
+
+  b1 = cache_get (inode->data.table, CACHE_WRITE);
+  t1 = cache_data (b1);
+  for (i = t1_s; success && i <= t1_t; i++)
+    {
+      off_t l = (i == t1_s ? t2_s : 0);
+      off_t r = (i == t1_t ? t2_t : TABLE_SIZE - 1);
+
+      if (t1[i] == (block_sector_t) -1)
+        {
+          if (!free_map_allocate (1, &t1[i]))
+            {
+              success = false;
+              break;
+            }
+          fill_sector (t1[i], 0xff);
+        }
+
+      b2 = cache_get (t1[i], CACHE_WRITE);
+      t2 = cache_data (b2);
+      for (j = l; j <= r; j++)
+        if (t2[j] == (block_sector_t) -1)
+          {
+            if (!free_map_allocate (1, &t2[j]))
+              {
+                success = false;
+                break;
+              }
+            fill_sector (t2[j], 0);
+          }
+      cache_put (b2);
+    }
+  cache_put (b1);
+  inode_invalidate_tables (inode);
+
+  if (success)
+    {
+      inode->data.length = pos + 1;
+      cache_write (inode->sector, &inode->data);
+    }
+  return success;
+}
+
+/* Extends INODE so that it contains byte offset POS.  The caller
+   is about to write bytes OFS through POS.
+   Returns false if disk allocation fails. */
+static bool
+inode_grow (struct inode *inode, off_t ofs, off_t pos)
+{
+  bool success;
+
+  if (!is_extent_inode (&inode->data))
+    return table_grow (inode, pos);
+
+  success = extent_resize (&inode->data, pos + 1, EXTENT_PREALLOC, ofs);
+  cache_write (inode->sector, &inode->data);
+  return success;
+}
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS, unless CREATE is true, in which case INODE is extended to
+   cover POS first. */
+static block_sector_t
+byte_to_sector (struct inode *inode, off_t pos, bool create) 
+{
+  block_sector_t *t2;
+  block_sector_t sector;
+
+  ASSERT (inode != NULL);
+
+  if (!(pos < inode->data.length))
+    if (!create || !inode_grow (inode, pos, pos))
+      return -1;
+
+  if (is_extent_inode (&inode->data))
+    return extent_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&inode->tables_lock);
+  t2 = inode_t2_table (inode, byte_to_t1 (pos));
+  if (t2 != NULL)
+    sector = t2[byte_to_t2 (pos)];
+  else
+    sector = table_lookup (table_lookup (inode->data.table, byte_to_t1 (pos)),
+                           byte_to_t2 (pos));
+  lock_release (&inode->tables_lock);
+  return sector;
 }
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
+static struct lock open_inodes_lock;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
-  memset(empty, -1, sizeof empty);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -167,61 +622,24 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  /* New inodes always use extents.  All of LENGTH is allocated up
+     front, with no slack, since the file may never be reopened. */
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
+      disk_inode->length = 0;
+      disk_inode->magic = INODE_EXTENT_MAGIC;
       disk_inode->is_dir = false;
-      if (free_map_allocate (1, &disk_inode->table)) 
+      disk_inode->overflow = -1;
+      if (extent_resize (disk_inode, length, 0, length))
         {
           cache_write (sector, disk_inode);
-          cache_write (disk_inode->table, empty);
-          
-          if(length > 0)
-            {
-              block_sector_t *t1 = calloc(TABLE_SIZE, sizeof *t1);
-              block_sector_t *t2 = calloc(TABLE_SIZE, sizeof *t2);
-              
-              int i, j;
-              off_t t1_t = byte_to_t1(length - 1);
-              off_t t2_t = byte_to_t2(length - 1);
-          
-              cache_read (disk_inode->table, t1);
-              for(i = 0; i <= t1_t; i++)
-                {
-                  off_t r = (i == t1_t ? t2_t : TABLE_SIZE - 1);
-              
-                  if (!free_map_allocate (1, &t1[i]))
-                  {
-                    free(t1);
-                    free(t2);
-                    free (disk_inode);
-                    return false;
-                  }
-                  cache_write(t1[i], empty);
-                 
-                  cache_read (t1[i], t2);
-                  for(j = 0; j <= r; j++)
-                    {
-                      if (!free_map_allocate (1, &t2[j]))
-                      {
-                        free(t1);
-                        free(t2);
-                        free (disk_inode);
-                        return false;
-                      }
-                      cache_write(t2[j], zeros);
-                    }
-                  cache_write (t1[i], t2);
-                }
-              cache_write (disk_inode->table, t1);
-             
-              free(t1);
-              free(t2);
-            }      
-          success = true; 
-        } 
+          success = true;
+        }
+      else
+        extent_truncate (disk_inode, 0);
       free (disk_inode);
     }
   return success;
@@ -237,13 +655,17 @@ inode_open (block_sector_t sector)
   struct inode *inode;
 
   /* Check whether this inode is already open. */
+  lock_acquire (&open_inodes_lock);
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
     {
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          while (inode->loading || inode->closing)
+            cond_wait (&inode->closed, &open_inodes_lock);
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
@@ -251,15 +673,43 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is put on the list before it is read
+     in, so that the read does not hold up other inodes; openers
+     that find it meanwhile wait for it to be loaded. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
+  inode->closing = false;
+  cond_init (&inode->closed);
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  rwlock_init (&inode->rw, true);
+  lock_init (&inode->dir_lock);
+  lock_init (&inode->ra_lock);
+  inode->ra_next = inode->ra_end = 0;
+  inode->ra_window = 0;
+  lock_init (&inode->tables_lock);
+  inode->t1 = NULL;
+  inode->t1_loaded = false;
+  for (int i = 0; i < T2_CACHE_SIZE; i++)
+    {
+      inode->t2[i].t1_idx = -1;
+      inode->t2[i].entries = NULL;
+    }
+  list_push_front (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->closed, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -268,7 +718,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -285,17 +739,53 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+
+  /* Give back the preallocated slack past the end of an extent
+     inode that stays on disk.  The free map and the disk are
+     updated without open_inodes_lock, but INODE stays on the list
+     meanwhile, so that a concurrent inode_open() finds it and waits
+     for the trimmed extents instead of reading the old ones back
+     in.  Such an opener keeps INODE alive. */
+  if (last && !inode->removed && is_extent_inode (&inode->data)
+      && inode->data.alloc_cnt > bytes_to_sectors (inode->data.length))
+    {
+      inode->closing = true;
+      lock_release (&open_inodes_lock);
+
+      extent_truncate (&inode->data, bytes_to_sectors (inode->data.length));
+      cache_write (inode->sector, &inode->data);
+
+      lock_acquire (&open_inodes_lock);
+      inode->closing = false;
+      cond_broadcast (&inode->closed, &open_inodes_lock);
+      last = inode->open_cnt == 0;
+    }
+  if (last)
+    list_remove (&inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Release resources if this was the last opener.  Nobody else
+     can reach INODE any more, so no other lock is needed. */
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (is_extent_inode (&inode->data))
+        {
+          if (inode->removed)
+            {
+              extent_truncate (&inode->data, 0);
+              free_map_release (inode->sector, 1);
+            }
+        }
+      else if (inode->removed) 
         {
           off_t length = inode->data.length;
 
@@ -329,6 +819,9 @@ inode_close (struct inode *inode)
           free_map_release (inode->data.table, 1);
         }
 
+      free (inode->t1);
+      for (int i = 0; i < T2_CACHE_SIZE; i++)
+        free (inode->t2[i].entries);
       free (inode); 
     }
 }
@@ -342,6 +835,52 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Notes a read of SIZE bytes at OFFSET in INODE and, if it
+   continues a sequential run, queues for read-ahead the sectors
+   past the last one it touches, which it reads itself.  The
+   window doubles on every sequential read, up to READ_AHEAD_MAX
+   sectors, and collapses on the first read that is not.  Readers
+   share INODE, so its read-ahead state has a lock of its own. */
+static void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t start, end, pos;
+
+  lock_acquire (&inode->ra_lock);
+  if (offset == inode->ra_next)
+    {
+      inode->ra_window *= 2;
+      if (inode->ra_window < READ_AHEAD_MIN)
+        inode->ra_window = READ_AHEAD_MIN;
+      if (inode->ra_window > READ_AHEAD_MAX)
+        inode->ra_window = READ_AHEAD_MAX;
+    }
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_end = 0;
+    }
+  inode->ra_next = offset + size;
+  if (inode->ra_window == 0)
+    {
+      lock_release (&inode->ra_lock);
+      return;
+    }
+
+  start = ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+  if (start < inode->ra_end)
+    start = inode->ra_end;
+  end = offset + size + inode->ra_window * BLOCK_SECTOR_SIZE;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (end > inode->ra_end)
+    inode->ra_end = end;
+  lock_release (&inode->ra_lock);
+
+  for (pos = start; pos < end; pos += BLOCK_SECTOR_SIZE)
+    cache_read_ahead (byte_to_sector (inode, pos, false));
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -350,13 +889,16 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  rwlock_acquire_read (&inode->rw);
+  inode_read_ahead (inode, offset, size);
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct cache_block *b;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -368,56 +910,67 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          cache_read (sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy straight out of the cached sector. */
+      b = cache_get (sector_idx, CACHE_READ);
+      memcpy (buffer + bytes_read, (uint8_t *) cache_data (b) + sector_ofs,
+              chunk_size);
+      cache_put (b);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the inode cannot be extended to hold all of
+   them or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool exclusive;
+
+  /* Files never shrink, so a write that fits now keeps fitting and
+     only needs the inode shared.  A write that does not fit takes
+     the inode exclusively and checks again, since another writer
+     may have extended the file in the meantime.  Extend the file in
+     one step, so that an extent inode can get all of its new
+     sectors as a single run. */
+  exclusive = size > 0 && offset + size > inode_length (inode);
+  if (exclusive)
+    rwlock_acquire_write (&inode->rw);
+  else
+    rwlock_acquire_read (&inode->rw);
 
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      bytes_written = 0;
+      goto done;
+    }
+  if (exclusive && offset + size > inode_length (inode)
+      && !inode_grow (inode, offset, offset + size - 1))
+    {
+      /* The disk is full.  Write only what fits in the file as it
+         stands. */
+      size = inode_length (inode) - offset;
+      if (size < 0)
+        size = 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset, true);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct cache_block *b;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -429,39 +982,25 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          cache_write (sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write (sector_idx, bounce);
-        }
+      /* Copy straight into the cached sector.  If the chunk covers
+         the whole sector, its old contents need not be read in. */
+      b = cache_get (sector_idx, chunk_size == BLOCK_SECTOR_SIZE
+                                 ? CACHE_OVERWRITE : CACHE_WRITE);
+      memcpy ((uint8_t *) cache_data (b) + sector_ofs, buffer + bytes_written,
+              chunk_size);
+      cache_put (b);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+ done:
+  if (exclusive)
+    rwlock_release_write (&inode->rw);
+  else
+    rwlock_release_read (&inode->rw);
   return bytes_written;
 }
 
@@ -470,8 +1009,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -480,9 +1021,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -503,12 +1046,48 @@ inode_isdir (const struct inode *inode)
 void
 inode_set_dir (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rw);
   inode->data.is_dir = true;
   cache_write (inode->sector, &inode->data);
+  rwlock_release_write (&inode->rw);
 }
 
 int inode_get_opencnt(struct inode *inode)
 {
-  return inode->open_cnt;
+  int open_cnt;
+
+  lock_acquire (&open_inodes_lock);
+  open_cnt = inode->open_cnt;
+  lock_release (&open_inodes_lock);
+  return open_cnt;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Acquires and releases the lock that serializes updates to the
+   entries of directory INODE. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns the sector holding byte offset POS of INODE, or -1 if
+   POS is past the end of INODE. */
+block_sector_t
+inode_get_sector (struct inode *inode, off_t pos)
+{
+  return byte_to_sector (inode, pos, false);
 }
 
@@ -25,6 +25,10 @@ void inode_set_dir (struct inode *);
 
 
 int inode_get_opencnt(struct inode *);
+bool inode_is_removed (const struct inode *);
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
+block_sector_t inode_get_sector (struct inode *, off_t pos);
 
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,216 @@
+#include "pheap.h"
+#include "../debug.h"
+
+/* A pairing heap is a tree in which every node is at least as
+   large as its children.  Each node points to its leftmost child,
+   and the children of a node form a doubly linked list through
+   `next' and `prev', except that the leftmost child's `prev'
+   points to the parent.  That back pointer is what lets an
+   arbitrary element be cut out of the tree in constant time. */
+
+static struct pheap_elem *meld (struct pheap *,
+                                struct pheap_elem *, struct pheap_elem *);
+static struct pheap_elem *merge_pairs (struct pheap *, struct pheap_elem *);
+
+/* Initializes HEAP as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+pheap_init (struct pheap *heap, pheap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->size = 0;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Returns the number of elements in HEAP. */
+size_t
+pheap_size (const struct pheap *heap)
+{
+  return heap->size;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+pheap_empty (const struct pheap *heap)
+{
+  return heap->root == NULL;
+}
+
+/* Returns the maximum element in HEAP, which must not be
+   empty. */
+struct pheap_elem *
+pheap_max (const struct pheap *heap)
+{
+  ASSERT (!pheap_empty (heap));
+  return heap->root;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+pheap_insert (struct pheap *heap, struct pheap_elem *elem)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  elem->child = elem->next = elem->prev = NULL;
+  heap->root = meld (heap, heap->root, elem);
+  heap->size++;
+}
+
+/* Removes and returns the maximum element in HEAP, which must
+   not be empty. */
+struct pheap_elem *
+pheap_pop_max (struct pheap *heap)
+{
+  struct pheap_elem *max = pheap_max (heap);
+
+  heap->root = merge_pairs (heap, max->child);
+  heap->size--;
+  max->child = NULL;
+  return max;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+pheap_remove (struct pheap *heap, struct pheap_elem *elem)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  if (elem == heap->root)
+    {
+      pheap_pop_max (heap);
+      return;
+    }
+
+  /* Cut ELEM and its subtree out of its parent's child list. */
+  if (elem->prev->child == elem)
+    elem->prev->child = elem->next;
+  else
+    elem->prev->next = elem->next;
+  if (elem->next != NULL)
+    elem->next->prev = elem->prev;
+  elem->next = elem->prev = NULL;
+
+  /* Put its children back. */
+  heap->root = meld (heap, heap->root, merge_pairs (heap, elem->child));
+  elem->child = NULL;
+  heap->size--;
+}
+
+/* Restores heap order after ELEM's key, in HEAP, has changed in
+   either direction. */
+void
+pheap_rekey (struct pheap *heap, struct pheap_elem *elem)
+{
+  pheap_remove (heap, elem);
+  pheap_insert (heap, elem);
+}
+
+/* Calls ACTION, given auxiliary data AUX, on every element of
+   HEAP, in no particular order, and then restores heap order.
+   ACTION may change the keys of any of the elements.  Takes
+   linear time. */
+void
+pheap_update_all (struct pheap *heap, pheap_action_func *action, void *aux)
+{
+  struct pheap_elem *todo = heap->root;
+  struct pheap_elem *all = NULL;
+
+  ASSERT (heap != NULL);
+  ASSERT (action != NULL);
+
+  /* Unlink every element onto ALL through its `next' member.
+     TODO holds the elements still to be visited, each followed
+     by its right siblings. */
+  while (todo != NULL)
+    {
+      struct pheap_elem *e = todo;
+
+      todo = e->next;
+      if (e->child != NULL)
+        {
+          struct pheap_elem *last = e->child;
+
+          while (last->next != NULL)
+            last = last->next;
+          last->next = todo;
+          todo = e->child;
+        }
+      e->child = e->prev = NULL;
+      e->next = all;
+      all = e;
+      action (e, aux);
+    }
+  heap->root = merge_pairs (heap, all);
+}
+
+/* Melds the heap-ordered trees rooted at A and B, either of
+   which may be null, and returns the root of the result.  A and
+   B must have no siblings. */
+static struct pheap_elem *
+meld (struct pheap *heap, struct pheap_elem *a, struct pheap_elem *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (heap->less (a, b, heap->aux))
+    {
+      struct pheap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  /* Make B the leftmost child of A. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Combines the sibling list starting at FIRST into one tree and
+   returns its root: siblings are melded in pairs from left to
+   right, then the pairs are melded from right to left.  This
+   two-pass order is what gives the pairing heap its amortized
+   bounds. */
+static struct pheap_elem *
+merge_pairs (struct pheap *heap, struct pheap_elem *first)
+{
+  struct pheap_elem *pairs = NULL;
+  struct pheap_elem *root = NULL;
+
+  /* First pass.  Melded pairs are stacked on PAIRS through their
+     `next' members, rightmost pair on top. */
+  while (first != NULL)
+    {
+      struct pheap_elem *a = first;
+      struct pheap_elem *b = a->next;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+      a = meld (heap, a, b);
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Second pass. */
+  while (pairs != NULL)
+    {
+      struct pheap_elem *next = pairs->next;
+      pairs->next = NULL;
+      root = meld (heap, root, pairs);
+      pairs = next;
+    }
+  if (root != NULL)
+    root->prev = NULL;
+  return root;
+}
@@ -0,0 +1,73 @@
+#ifndef __LIB_KERNEL_PHEAP_H
+#define __LIB_KERNEL_PHEAP_H
+
+/* Pairing heap.
+
+   A max-heap that, like the doubly linked list in list.h, needs
+   no dynamically allocated memory: each structure that can be in
+   a heap embeds a struct pheap_elem, and pheap_entry() converts
+   a pointer to that member back to the enclosing structure.
+
+   Insertion and melding take constant time; removing the
+   maximum, or an arbitrary element, takes O(lg n) amortized
+   time.  An element whose key has changed is put back in order
+   with pheap_rekey().
+
+   The heap orders elements with a caller-supplied "less"
+   function.  Elements that compare equal come out in no
+   particular order, so a caller that wants FIFO order among
+   equals must break ties itself, e.g. with a sequence number. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct pheap_elem
+  {
+    struct pheap_elem *child;   /* Leftmost child. */
+    struct pheap_elem *next;    /* Next sibling. */
+    struct pheap_elem *prev;    /* Previous sibling, or parent if leftmost. */
+  };
+
+/* Converts pointer to heap element PHEAP_ELEM into a pointer to
+   the structure that PHEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define pheap_entry(PHEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(PHEAP_ELEM)->child     \
+                     - offsetof (STRUCT, MEMBER.child)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool pheap_less_func (const struct pheap_elem *a,
+                              const struct pheap_elem *b,
+                              void *aux);
+
+/* Performs some operation on heap element E, given auxiliary
+   data AUX. */
+typedef void pheap_action_func (struct pheap_elem *e, void *aux);
+
+/* Pairing heap. */
+struct pheap
+  {
+    struct pheap_elem *root;    /* Maximum element, or null. */
+    size_t size;                /* Number of elements. */
+    pheap_less_func *less;      /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void pheap_init (struct pheap *, pheap_less_func *, void *aux);
+
+size_t pheap_size (const struct pheap *);
+bool pheap_empty (const struct pheap *);
+struct pheap_elem *pheap_max (const struct pheap *);
+
+void pheap_insert (struct pheap *, struct pheap_elem *);
+struct pheap_elem *pheap_pop_max (struct pheap *);
+void pheap_remove (struct pheap *, struct pheap_elem *);
+void pheap_rekey (struct pheap *, struct pheap_elem *);
+void pheap_update_all (struct pheap *, pheap_action_func *, void *aux);
+
+#endif /* lib/kernel/pheap.h */
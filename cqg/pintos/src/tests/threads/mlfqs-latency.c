@@ -0,0 +1,121 @@
+/* Measures how long the timer interrupt takes under the MLFQS
+   scheduler with 500 threads in the system.
+
+   500 threads are started and left blocked on a semaphore.  The
+   main thread then spins for a few seconds, reading the time
+   stamp counter in a tight loop.  Whenever timer_ticks() has
+   moved on since the previous iteration, that iteration's length
+   is charged to the timer interrupt, separately for ordinary
+   ticks and for the once-a-second ticks that update load_avg and
+   recent_cpu.  The per-second interrupt should cost about the
+   same as an ordinary one no matter how many threads are
+   blocked.
+
+   The cycle counts depend on the host and simulator, so only
+   their presence is checked. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 500
+#define SECONDS 5
+
+/* Interrupt cost summary. */
+struct latency
+  {
+    uint64_t total;             /* Sum of cycles. */
+    uint64_t max;               /* Longest one. */
+    unsigned cnt;               /* Number of interrupts seen. */
+  };
+
+static void blocked_thread (void *aux);
+static void record (struct latency *, uint64_t cycles);
+static void report (const char *what, const struct latency *);
+
+static struct semaphore wake, done;
+
+void
+test_mlfqs_latency (void)
+{
+  struct latency tick_latency = {0, 0, 0};
+  struct latency second_latency = {0, 0, 0};
+  int64_t start_time, last_tick;
+  uint64_t prev;
+  int i;
+
+  ASSERT (thread_mlfqs);
+
+  sema_init (&wake, 0);
+  sema_init (&done, 0);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "blocked %d", i);
+      if (thread_create (name, PRI_DEFAULT, blocked_thread, NULL) == TID_ERROR)
+        fail ("creating thread %d failed", i);
+    }
+  msg ("Started %d blocked threads.", THREAD_CNT);
+
+  /* Start measuring on a tick boundary. */
+  start_time = timer_ticks ();
+  while (timer_ticks () == start_time)
+    continue;
+
+  start_time = last_tick = timer_ticks ();
+  prev = rdtsc ();
+  while (last_tick - start_time < SECONDS * TIMER_FREQ)
+    {
+      int64_t tick = timer_ticks ();
+      uint64_t now = rdtsc ();
+
+      if (tick != last_tick)
+        {
+          if (tick % TIMER_FREQ == 0)
+            record (&second_latency, now - prev);
+          else
+            record (&tick_latency, now - prev);
+          last_tick = tick;
+        }
+      prev = now;
+    }
+
+  report ("Per-tick interrupt", &tick_latency);
+  report ("Per-second interrupt", &second_latency);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_up (&wake);
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  msg ("All %d threads finished.", THREAD_CNT);
+}
+
+static void
+blocked_thread (void *aux UNUSED)
+{
+  sema_down (&wake);
+  sema_up (&done);
+}
+
+/* Adds an interrupt that took CYCLES to L. */
+static void
+record (struct latency *l, uint64_t cycles)
+{
+  l->total += cycles;
+  if (cycles > l->max)
+    l->max = cycles;
+  l->cnt++;
+}
+
+/* Prints L's summary. */
+static void
+report (const char *what, const struct latency *l)
+{
+  if (l->cnt == 0)
+    fail ("%s: no interrupts seen", what);
+  msg ("%s: %u samples, average %llu cycles, max %llu cycles.",
+       what, l->cnt, l->total / l->cnt, l->max);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Timings vary from run to run, so only check that they were
+# measured and that the blocked threads all got to finish.
+foreach my $what ('Per-tick interrupt', 'Per-second interrupt') {
+    fail "$what latency missing\n"
+      if !grep (/^\($test\) $what: \d+ samples, average \d+ cycles, max \d+ cycles\.$/, @output);
+}
+fail "blocked threads did not all finish\n"
+  if !grep (/^\($test\) All 500 threads finished\.$/, @output);
+pass;
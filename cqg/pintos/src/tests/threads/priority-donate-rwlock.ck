@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF_']);
+(priority-donate-rwlock) begin
+(priority-donate-rwlock) This thread should have priority 32.  Actual priority: 32.
+(priority-donate-rwlock) This thread should have priority 33.  Actual priority: 33.
+(priority-donate-rwlock) writer: got the rwlock
+(priority-donate-rwlock) writer: done
+(priority-donate-rwlock) reader: got the rwlock
+(priority-donate-rwlock) reader: done
+(priority-donate-rwlock) writer, reader must already have finished, in that order.
+(priority-donate-rwlock) This thread should have priority 31.  Actual priority: 31.
+(priority-donate-rwlock) end
+EOF_
+pass;
@@ -0,0 +1,154 @@
+/* Builds deep and wide priority donation graphs and checks that
+   the main thread ends up with the right effective priority,
+   and measures how long donation and lock operations take.
+
+   Deep: the main thread, at PRI_MIN, holds lock[0].  Thread[i]
+   (priority PRI_MIN + 3 * i) acquires lock[i] and then waits for
+   lock[i-1], so each new thread donates through a chain of i
+   locks to the main thread.  The chain is built twice, once
+   within the donation depth cap and once with the cap lowered
+   to 2, in which case the main thread only sees the donation
+   from thread[2].
+
+   Wide: the main thread holds 8 locks with 4 waiters each, all
+   at different priorities.  Releasing the locks from the most
+   to the least donated should lower the main thread's priority
+   step by step.
+
+   Cycle counts depend on the host and simulator, so only their
+   presence is checked. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define CHAIN_DEPTH 7
+#define WIDE_LOCKS 8
+#define WIDE_WAITERS 4
+#define UNCONTENDED_ITERS 1000
+
+struct chain_link
+  {
+    int id;                     /* Thread number, 1...CHAIN_DEPTH. */
+    struct lock *own;           /* Lock to hold, or NULL. */
+    struct lock *wait;          /* Lock held by the previous link. */
+  };
+
+static struct lock chain_locks[CHAIN_DEPTH];
+static struct chain_link links[CHAIN_DEPTH + 1];
+static struct lock wide_locks[WIDE_LOCKS];
+static uint64_t donate_start;
+
+static thread_func chain_thread;
+static thread_func wide_thread;
+static void run_chain (unsigned cap);
+
+void
+test_priority_donate_stress (void)
+{
+  struct lock lock;
+  uint64_t start;
+  int i, j;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  thread_set_priority (PRI_MIN);
+
+  run_chain (lock_donation_depth);
+  run_chain (2);
+
+  for (i = 0; i < WIDE_LOCKS; i++)
+    {
+      lock_init (&wide_locks[i]);
+      lock_acquire (&wide_locks[i]);
+    }
+  for (i = 0; i < WIDE_LOCKS; i++)
+    for (j = 0; j < WIDE_WAITERS; j++)
+      {
+        char name[16];
+        snprintf (name, sizeof name, "wide %d.%d", i, j);
+        thread_create (name, PRI_MIN + 1 + i * WIDE_WAITERS + j,
+                       wide_thread, &wide_locks[i]);
+      }
+  msg ("Main thread priority %d with %d waiters on %d locks.",
+       thread_get_priority (), WIDE_LOCKS * WIDE_WAITERS, WIDE_LOCKS);
+
+  lock_init (&lock);
+  start = rdtsc ();
+  for (i = 0; i < UNCONTENDED_ITERS; i++)
+    {
+      lock_acquire (&lock);
+      lock_release (&lock);
+    }
+  msg ("Uncontended acquire and release with donations held: %llu cycles.",
+       (rdtsc () - start) / UNCONTENDED_ITERS);
+
+  for (i = WIDE_LOCKS - 1; i >= 0; i--)
+    {
+      lock_release (&wide_locks[i]);
+      msg ("Released lock %d, main thread priority %d.",
+           i, thread_get_priority ());
+    }
+}
+
+/* Builds a chain of CHAIN_DEPTH donors with the donation depth
+   cap set to CAP, then lets it unwind. */
+static void
+run_chain (unsigned cap)
+{
+  unsigned saved_cap = lock_donation_depth;
+  uint64_t cycles;
+  int i;
+
+  lock_donation_depth = cap;
+  for (i = 0; i < CHAIN_DEPTH; i++)
+    lock_init (&chain_locks[i]);
+  lock_acquire (&chain_locks[0]);
+
+  for (i = 1; i <= CHAIN_DEPTH; i++)
+    {
+      char name[16];
+      links[i].id = i;
+      links[i].own = i < CHAIN_DEPTH ? &chain_locks[i] : NULL;
+      links[i].wait = &chain_locks[i - 1];
+      snprintf (name, sizeof name, "chain %d", i);
+      thread_create (name, PRI_MIN + i * 3, chain_thread, &links[i]);
+    }
+  cycles = rdtsc () - donate_start;
+  msg ("Cap %u: main thread priority %d after a chain of %d.",
+       cap, thread_get_priority (), CHAIN_DEPTH);
+  msg ("Cap %u: donation through the chain took %llu cycles.",
+       cap, cycles);
+
+  lock_release (&chain_locks[0]);
+  msg ("Cap %u: chain done, main thread priority %d.",
+       cap, thread_get_priority ());
+  lock_donation_depth = saved_cap;
+}
+
+static void
+chain_thread (void *link_)
+{
+  struct chain_link *link = link_;
+
+  if (link->own != NULL)
+    lock_acquire (link->own);
+  donate_start = rdtsc ();
+  lock_acquire (link->wait);
+  msg ("Chain thread %d got lock.", link->id);
+  lock_release (link->wait);
+  if (link->own != NULL)
+    lock_release (link->own);
+}
+
+static void
+wide_thread (void *lock_)
+{
+  struct lock *lock = lock_;
+
+  lock_acquire (lock);
+  lock_release (lock);
+}
@@ -0,0 +1,51 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run, so only check that they were
+# measured, then compare the rest exactly.
+foreach my $what ('Cap 8: donation through the chain took',
+                  'Cap 2: donation through the chain took',
+                  'Uncontended acquire and release with donations held:') {
+    fail "\"$what\" missing\n"
+      if !grep (/^\($test\) \Q$what\E \d+ cycles\.$/, @output);
+}
+@output = grep (!/ cycles\.$/, @output);
+
+compare_output ("run", [<<'EOF_'], \@output);
+(priority-donate-stress) begin
+(priority-donate-stress) Cap 8: main thread priority 21 after a chain of 7.
+(priority-donate-stress) Chain thread 1 got lock.
+(priority-donate-stress) Chain thread 2 got lock.
+(priority-donate-stress) Chain thread 3 got lock.
+(priority-donate-stress) Chain thread 4 got lock.
+(priority-donate-stress) Chain thread 5 got lock.
+(priority-donate-stress) Chain thread 6 got lock.
+(priority-donate-stress) Chain thread 7 got lock.
+(priority-donate-stress) Cap 8: chain done, main thread priority 0.
+(priority-donate-stress) Cap 2: main thread priority 6 after a chain of 7.
+(priority-donate-stress) Chain thread 1 got lock.
+(priority-donate-stress) Chain thread 2 got lock.
+(priority-donate-stress) Chain thread 3 got lock.
+(priority-donate-stress) Chain thread 4 got lock.
+(priority-donate-stress) Chain thread 5 got lock.
+(priority-donate-stress) Chain thread 6 got lock.
+(priority-donate-stress) Chain thread 7 got lock.
+(priority-donate-stress) Cap 2: chain done, main thread priority 0.
+(priority-donate-stress) Main thread priority 32 with 32 waiters on 8 locks.
+(priority-donate-stress) Released lock 7, main thread priority 28.
+(priority-donate-stress) Released lock 6, main thread priority 24.
+(priority-donate-stress) Released lock 5, main thread priority 20.
+(priority-donate-stress) Released lock 4, main thread priority 16.
+(priority-donate-stress) Released lock 3, main thread priority 12.
+(priority-donate-stress) Released lock 2, main thread priority 8.
+(priority-donate-stress) Released lock 1, main thread priority 4.
+(priority-donate-stress) Released lock 0, main thread priority 0.
+(priority-donate-stress) end
+EOF_
+pass;
@@ -0,0 +1,74 @@
+/* Checks how a reader-writer lock orders readers and writers.
+
+   The main thread acquires the rwlock for reading.  A writer at
+   priority PRI_DEFAULT + 1 then blocks on it, waiting for the
+   main thread to leave, and a reader at PRI_DEFAULT + 2 tries to
+   acquire it for reading.
+
+   Without writer preference the reader shares the rwlock with
+   the main thread right away, and the writer only gets it once
+   the main thread releases it.
+
+   With writer preference the reader queues behind the waiting
+   writer and donates its priority to it, so when the main thread
+   releases the rwlock the writer runs first, then the reader. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread_func;
+static thread_func writer_thread_func;
+static void run (bool prefer_writers);
+
+void
+test_priority_rwlock (void)
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  run (false);
+  run (true);
+}
+
+static void
+run (bool prefer_writers)
+{
+  struct rwlock rw;
+
+  msg ("Testing %s preference.", prefer_writers ? "writer" : "reader");
+  rwlock_init (&rw, prefer_writers);
+  rwlock_acquire_read (&rw);
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread_func, &rw);
+  thread_create ("reader", PRI_DEFAULT + 2, reader_thread_func, &rw);
+  msg ("main: releasing the rwlock");
+  rwlock_release_read (&rw);
+  msg ("main: done");
+}
+
+static void
+reader_thread_func (void *rw_)
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_read (rw);
+  msg ("reader: got the rwlock");
+  rwlock_release_read (rw);
+  msg ("reader: done");
+}
+
+static void
+writer_thread_func (void *rw_)
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_write (rw);
+  msg ("writer: got the rwlock");
+  rwlock_release_write (rw);
+  msg ("writer: done");
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF_']);
+(priority-rwlock) begin
+(priority-rwlock) Testing reader preference.
+(priority-rwlock) reader: got the rwlock
+(priority-rwlock) reader: done
+(priority-rwlock) main: releasing the rwlock
+(priority-rwlock) writer: got the rwlock
+(priority-rwlock) writer: done
+(priority-rwlock) main: done
+(priority-rwlock) Testing writer preference.
+(priority-rwlock) main: releasing the rwlock
+(priority-rwlock) writer: got the rwlock
+(priority-rwlock) reader: got the rwlock
+(priority-rwlock) reader: done
+(priority-rwlock) writer: done
+(priority-rwlock) main: done
+(priority-rwlock) end
+EOF_
+pass;
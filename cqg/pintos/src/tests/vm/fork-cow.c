@@ -0,0 +1,50 @@
+/* Forks a child that checks and then overwrites a buffer the
+   parent filled in, and verifies that the parent's copy is left
+   as it was. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+static void
+check_buf (const char *who, char xor)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) ((i * 257) ^ xor))
+      fail ("%s: byte %zu is %d", who, i, buf[i]);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  int status;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i * 257;
+
+  child = fork ();
+  if (child == 0)
+    {
+      check_buf ("child", 0);
+      for (i = 0; i < SIZE; i++)
+        buf[i] ^= 0x5a;
+      check_buf ("child", 0x5a);
+      msg ("child: contents verified");
+      exit (81);
+    }
+  if (child == -1)
+    fail ("fork failed");
+
+  status = wait (child);
+  CHECK (status == 81, "wait for child");
+  check_buf ("parent", 0);
+  msg ("parent: contents verified");
+}
@@ -34,6 +34,19 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Arrival counter, used to keep waiters of equal priority in
+   FIFO order. */
+static unsigned wait_seq;
+
+static bool waiter_less (const struct thread *a, unsigned a_seq,
+                         const struct thread *b, unsigned b_seq);
+static pheap_less_func sema_waiter_less;
+static pheap_less_func cond_waiter_less;
+static void waiters_refresh (struct pheap *, int *second,
+                             pheap_action_func *);
+static pheap_action_func sema_waiter_refresh;
+static pheap_action_func cond_waiter_refresh;
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -49,7 +62,8 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  pheap_init (&sema->waiters, sema_waiter_less, NULL);
+  sema->waiters_second = thread_mlfqs_seconds ();
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -70,7 +84,11 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0)
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      struct thread *cur = thread_current ();
+
+      cur->wait_seq = wait_seq++;
+      cur->waiting_sema = sema;
+      pheap_insert (&sema->waiters, &cur->wait_elem);
       thread_block ();
     }
   sema->value--;
@@ -113,46 +131,96 @@ sema_up (struct semaphore *sema)
   enum intr_level old_level;
 
   ASSERT (sema != NULL);
-  sema->value++;
-  old_level = intr_disable ();
 
-  if (!list_empty (&sema->waiters))
+  old_level = intr_disable ();
+  sema->value++;
+  if (!pheap_empty (&sema->waiters))
     {
-      //Pop the thread with the max priority.
-      struct thread *t = list_entry (list_pop_front (&sema->waiters), struct thread, elem);
-      int max = thread_get_certain_priority (t);
-      struct thread *t_max = t;
-      list_push_back (&sema->waiters, &t->elem);
-      struct thread *t_tmp;
-      int tmp;
-      while (true)
-        {
-          t_tmp = list_entry (list_pop_front (&sema->waiters), struct thread, elem);
-          list_push_back (&sema->waiters, &t_tmp->elem);
-          if (t_tmp == t)
-            break;
-          tmp = thread_get_certain_priority (t_tmp);
-          if (tmp > max)
-            {
-              max = tmp;
-              t_max = t_tmp;
-            }
-        }
-      while (true)
-        {
-          t_tmp = list_entry (list_pop_front (&sema->waiters), struct thread, elem);
-          if (t_tmp == t_max)
-            break;
-          list_push_back (&sema->waiters, &t_tmp->elem);
-        }
-      thread_unblock (t_tmp);
+      struct thread *t;
+
+      /* Wake the waiter with the highest priority. */
+      waiters_refresh (&sema->waiters, &sema->waiters_second,
+                       sema_waiter_refresh);
+      t = pheap_entry (pheap_pop_max (&sema->waiters),
+                       struct thread, wait_elem);
+      t->waiting_sema = NULL;
+      thread_unblock (t);
       thread_revolt ();
     }
+  intr_set_level (old_level);
+}
 
+/* Puts blocked thread T back in order among the waiters of the
+   semaphore or condition variable it waits on, after its
+   priority has changed. */
+void
+synch_priority_changed (struct thread *t)
+{
+  enum intr_level old_level = intr_disable ();
 
+  if (t->waiting_sema != NULL)
+    pheap_rekey (&t->waiting_sema->waiters, &t->wait_elem);
+  if (t->waiting_cond != NULL)
+    pheap_rekey (&t->waiting_cond->waiters, t->cond_elem);
   intr_set_level (old_level);
 }
 
+/* Returns true if waiter A, which arrived as number A_SEQ, should
+   be woken after waiter B, which arrived as number B_SEQ: A has
+   lower priority, or equal priority and arrived later. */
+static bool
+waiter_less (const struct thread *a, unsigned a_seq,
+             const struct thread *b, unsigned b_seq)
+{
+  int a_pri = thread_get_certain_priority (a);
+  int b_pri = thread_get_certain_priority (b);
+
+  if (a_pri != b_pri)
+    return a_pri < b_pri;
+  return (int) (a_seq - b_seq) > 0;
+}
+
+/* Under the MLFQS scheduler a blocked thread's priority is only
+   recomputed once it is woken, so WAITERS may be out of order if
+   any once-a-second update has happened since *SECOND.  In that
+   case, brings every waiter up to date with REFRESH and restores
+   the order.  This costs time linear in the number of waiters, but
+   at most once a second for each semaphore or condition. */
+static void
+waiters_refresh (struct pheap *waiters, int *second,
+                 pheap_action_func *refresh)
+{
+  int now;
+
+  if (!thread_mlfqs)
+    return;
+  now = thread_mlfqs_seconds ();
+  if (*second != now)
+    {
+      pheap_update_all (waiters, refresh, NULL);
+      *second = now;
+    }
+}
+
+/* Recomputes the MLFQS priority of the thread waiting through
+   E, an element of a semaphore's waiters. */
+static void
+sema_waiter_refresh (struct pheap_elem *e, void *aux UNUSED)
+{
+  thread_mlfqs_refresh (pheap_entry (e, struct thread, wait_elem));
+}
+
+/* Orders threads in a semaphore's waiters. */
+static bool
+sema_waiter_less (const struct pheap_elem *a_, const struct pheap_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct thread *a = pheap_entry (a_, struct thread, wait_elem);
+  const struct thread *b = pheap_entry (b_, struct thread, wait_elem);
+
+  return waiter_less (a, a->wait_seq, b, b->wait_seq);
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -190,6 +258,15 @@ sema_test_helper (void *sema_)
     }
 }
 
+/* Maximum number of locks a donation is passed through, from the
+   waiting thread to the holder, to the lock that holder waits
+   on, and so on.  Bounds the work done by lock_acquire() in
+   deep or cyclic wait-for chains.  Set by the kernel
+   command-line option "-donate-depth". */
+unsigned lock_donation_depth = 8;
+
+static void donate_priority (struct thread *);
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -211,40 +288,37 @@ lock_init (struct lock *lock)
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
-  lock->max_donate = 0;
-  list_init (&lock->donaters);
+  lock->max_priority = PRI_MIN;
   sema_init (&lock->semaphore, 1);
 }
 
-/* The thread (with thread_lockers ID : tpos) has had a new donation,
-   now it need to pass that back to its father along the chain in the waiting DAG. */
-void
-notify_father (struct thread *t)
+/* Passes T's effective priority along the chain of locks it is
+   waiting for: each lock remembers the highest priority among
+   its waiters, and each holder is raised to it.  Stops as soon
+   as a holder already has at least that priority, or after
+   lock_donation_depth locks.  Must be called with interrupts
+   off. */
+static void
+donate_priority (struct thread *t)
 {
-  if (t == NULL)
-    return;
-  struct thread *father = t->father;
-  if (father == NULL)
-    return;
-  int old_donate = father->max_donate;
+  int priority = t->eff_priority;
+  struct lock *lock = t->waiting_lock;
+  unsigned depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  struct list_elem *el, *ed;
-  struct lock *l;
-  struct thread *tmp;
-  for (el = list_begin (&father->lock_list); el != list_end (&father->lock_list); el = list_next (el))
+  for (depth = 0; lock != NULL && depth < lock_donation_depth; depth++)
     {
-      l = list_entry (el, struct lock, elem);
-      for (ed = list_begin (&l->donaters); ed != list_end (&l->donaters); ed = list_next (ed))
-        {
-          tmp = list_entry (ed, struct thread, donate_elem);
-          if (tmp->priority + tmp->max_donate - father->priority > l->max_donate)
-            l->max_donate = tmp->priority + tmp->max_donate - father->priority;
-        }
-      if (l->max_donate > father->max_donate)
-        father->max_donate = l->max_donate;
+      struct thread *holder = lock->holder;
+
+      if (lock->max_priority < priority)
+        lock->max_priority = priority;
+      if (holder == NULL || holder->eff_priority >= priority)
+        break;
+      holder->eff_priority = priority;
+      thread_priority_changed (holder);
+      lock = holder->waiting_lock;
     }
-  if (father->max_donate != old_donate)
-    notify_father (father);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -258,37 +332,40 @@ notify_father (struct thread *t)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  /* The lock has been locked, so deal with the waiting relation and donation stuff. */
-  if (lock->holder != NULL && thread_get_priority () > lock->holder->priority)
-    {
-      int delta = thread_get_priority () - lock->holder->priority;
-      struct thread *t = thread_current ();
-      t->father = lock->holder;
-
-      list_push_back (&lock->donaters, &t->donate_elem);
-
-      if (delta > lock->max_donate)
-        {
-          lock->max_donate = delta;
-        }
-
-      if (delta > lock->holder->max_donate)
-        {
-          lock->holder->max_donate = delta;
-          notify_father (lock->holder);
-        }
+  old_level = intr_disable ();
 
+  /* The lock has been locked, so donate our priority along the
+     wait-for chain before going to sleep. */
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      cur->waiting_lock = lock;
+      donate_priority (cur);
     }
 
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back (&cur->lock_list, &lock->elem);
 
-  /* Got the new lock successfully. Initialize it. */
-  list_push_back (&lock->holder->lock_list, &lock->elem);
+  /* Threads still waiting for the lock now donate to us. */
+  lock->max_priority = PRI_MIN;
+  if (!pheap_empty (&lock->semaphore.waiters))
+    {
+      struct thread *t = pheap_entry (pheap_max (&lock->semaphore.waiters),
+                                      struct thread, wait_elem);
+      lock->max_priority = thread_get_certain_priority (t);
+      if (cur->eff_priority < lock->max_priority)
+        cur->eff_priority = lock->max_priority;
+    }
+
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -300,14 +377,21 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      lock->max_priority = PRI_MIN;
+      list_push_back (&lock->holder->lock_list, &lock->elem);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -319,46 +403,20 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  struct thread *t = lock->holder;
-
-  /* Cut down the donation. */
-  struct list_elem *e;
-  for (e = list_begin (&lock->donaters); e != list_end (&lock->donaters); e = list_next (e))
-    {
-      struct thread *son = list_entry (e, struct thread, donate_elem);
-      son->father = NULL;
-    }
-  while (!list_empty (&lock->donaters))
-    list_pop_front (&lock->donaters);
+  old_level = intr_disable ();
   list_remove (&lock->elem);
-
-  lock->max_donate = 0;
   lock->holder = NULL;
-  sema_up (&lock->semaphore);
+  lock->max_priority = PRI_MIN;
 
-  /* Update the lock holder's donation information and notify its father if necessary. */
-  int old_donate = t->max_donate;
-  t->max_donate = 0;
-  for (e = list_begin (&t->lock_list); e != list_end (&t->lock_list); e = list_next (e))
-    {
-      struct lock *l = list_entry (e, struct lock, elem);
-      if (l->max_donate > t->max_donate)
-        t->max_donate = l->max_donate;
-    }
-  if (t->max_donate != old_donate)
-    {
-      notify_father (t);
-    }
-
-  if (t->max_donate == 0 && t->priority_to_set > -1)
-    {
-      t->priority = t->priority_to_set;
-      t->priority_to_set = -1;
-    }
-  thread_revolt ();
+  /* Give up the donations that came through LOCK. */
+  thread_refresh_priority (thread_current ());
+  sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -372,14 +430,156 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/* Initializes RW as an unlocked reader-writer lock.  Any number
+   of readers may hold RW at once, or a single writer.
+
+   A writer holds RW's internal lock for as long as it writes, so
+   threads that wait for the writer donate their priority to it,
+   as they would for a plain lock.  Readers only hold the
+   internal lock while they enter, so they do not receive
+   donations.
+
+   If PREFER_WRITERS is true, a writer keeps the internal lock
+   while it waits for the current readers to leave, so readers
+   arriving after it queue behind it.  Otherwise new readers keep
+   entering as long as any reader is in, which can starve
+   writers. */
+void
+rwlock_init (struct rwlock *rw, bool prefer_writers)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  sema_init (&rw->drained, 0);
+  rw->readers = 0;
+  rw->waiting_writers = 0;
+  rw->prefer_writers = prefer_writers;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it (or,
+   with writer preference, while a writer is waiting for it).
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  rw->readers++;
+  intr_set_level (old_level);
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for reading.
+   The last reader to leave wakes the writers waiting for the
+   readers to drain. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    for (; rw->waiting_writers > 0; rw->waiting_writers--)
+      sema_up (&rw->drained);
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  for (;;)
+    {
+      lock_acquire (&rw->lock);
+      old_level = intr_disable ();
+      if (rw->readers == 0)
+        {
+          intr_set_level (old_level);
+          return;
+        }
+      rw->waiting_writers++;
+      intr_set_level (old_level);
+
+      /* With writer preference no reader can get in while we hold
+         the lock, so the readers are gone once we are woken. */
+      if (rw->prefer_writers)
+        {
+          sema_down (&rw->drained);
+          return;
+        }
+      lock_release (&rw->lock);
+      sema_down (&rw->drained);
+    }
+}
+
+/* Releases RW, which the current thread must hold for
+   writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->lock);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem
   {
-    struct list_elem elem;              /* List element. */
+    struct pheap_elem elem;             /* Heap element. */
     struct semaphore semaphore;         /* This semaphore. */
-    struct thread *pthread;
+    struct thread *pthread;             /* Waiting thread. */
+    unsigned seq;                       /* Arrival order. */
   };
 
+/* Orders semaphore_elems in a condition's waiters by the
+   priority of their threads. */
+static bool
+cond_waiter_less (const struct pheap_elem *a_, const struct pheap_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct semaphore_elem *a = pheap_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = pheap_entry (b_, struct semaphore_elem, elem);
+
+  return waiter_less (a->pthread, a->seq, b->pthread, b->seq);
+}
+
+/* Recomputes the MLFQS priority of the thread waiting through
+   E, an element of a condition's waiters. */
+static void
+cond_waiter_refresh (struct pheap_elem *e, void *aux UNUSED)
+{
+  thread_mlfqs_refresh (pheap_entry (e, struct semaphore_elem, elem)->pthread);
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -388,7 +588,8 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  pheap_init (&cond->waiters, cond_waiter_less, NULL);
+  cond->waiters_second = thread_mlfqs_seconds ();
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -415,6 +616,8 @@ void
 cond_wait (struct condition *cond, struct lock *lock)
 {
   struct semaphore_elem waiter;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
@@ -422,9 +625,18 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
 
   sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  waiter.pthread = cur;
+
+  /* The heap is also touched by synch_priority_changed() from
+     threads that do not hold LOCK, hence interrupts off. */
+  old_level = intr_disable ();
+  waiter.seq = wait_seq++;
+  pheap_insert (&cond->waiters, &waiter.elem);
+  cur->waiting_cond = cond;
+  cur->cond_elem = &waiter.elem;
+  intr_set_level (old_level);
+
   lock_release (lock);
-  waiter.pthread = thread_current ();
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
@@ -444,37 +656,20 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters))
+  enum intr_level old_level = intr_disable ();
+  if (!pheap_empty (&cond->waiters))
     {
-      /* Pop the thread with the max priority in the cond waiters. */
-      struct semaphore_elem *t = list_entry (list_pop_front (&cond->waiters), struct semaphore_elem, elem);
-      int max = thread_get_certain_priority (t->pthread);
-      struct semaphore_elem *t_max = t;
-      list_push_back (&cond->waiters, &t->elem);
-      struct semaphore_elem *t_tmp;
-      int tmp;
-      while (true)
-        {
-          t_tmp = list_entry (list_pop_front (&cond->waiters), struct semaphore_elem, elem);
-          list_push_back (&cond->waiters, &t_tmp->elem);
-          if (t_tmp == t)
-            break;
-          tmp = thread_get_certain_priority (t_tmp->pthread);
-          if (tmp > max)
-            {
-              max = tmp;
-              t_max = t_tmp;
-            }
-        }
-      while (true)
-        {
-          t_tmp = (list_entry (list_pop_front (&cond->waiters), struct semaphore_elem, elem));
-          if (t_tmp == t_max)
-            break;
-          list_push_back (&cond->waiters, &t_tmp->elem);
-        }
-      sema_up (&t_tmp->semaphore);
+      struct semaphore_elem *waiter;
+
+      /* Signal the waiter with the highest priority. */
+      waiters_refresh (&cond->waiters, &cond->waiters_second,
+                       cond_waiter_refresh);
+      waiter = pheap_entry (pheap_pop_max (&cond->waiters),
+                            struct semaphore_elem, elem);
+      waiter->pthread->waiting_cond = NULL;
+      sema_up (&waiter->semaphore);
     }
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -489,7 +684,7 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!pheap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
 
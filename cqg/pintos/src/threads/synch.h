@@ -2,13 +2,17 @@
 #define THREADS_SYNCH_H
 
 #include <list.h>
+#include <pheap.h>
 #include <stdbool.h>
 
+struct thread;
+
 /* A counting semaphore. */
 struct semaphore
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct pheap waiters;       /* Waiting threads, by priority. */
+    int waiters_second;         /* MLFQS second WAITERS is ordered for. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -19,26 +23,47 @@ void sema_up (struct semaphore *);
 
 void sema_self_test (void);
 
+void synch_priority_changed (struct thread *);
+
 /* Lock. */
 struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-    int max_donate;             /* Max donation. */
-    struct list donaters;       /* Donater list. */
+    int max_priority;           /* Highest priority among waiters. */
     struct list_elem elem;      /* List element for lock list. */
   };
 
+extern unsigned lock_donation_depth;
+
 void lock_init (struct lock *);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by the writer, if any. */
+    struct semaphore drained;   /* Wakes writers when readers leave. */
+    unsigned readers;           /* Number of readers holding the lock. */
+    unsigned waiting_writers;   /* Writers waiting for readers to leave. */
+    bool prefer_writers;        /* Hold off new readers while writing. */
+  };
+
+void rwlock_init (struct rwlock *, bool prefer_writers);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Condition variable. */
 struct condition
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct pheap waiters;       /* Waiting threads, by priority. */
+    int waiters_second;         /* MLFQS second WAITERS is ordered for. */
   };
 
 void cond_init (struct condition *);
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <filesys/filesys.h>
 #include "filesys/file.h"
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -16,8 +17,12 @@
 #include "threads/vaddr.h"
 
 #ifdef USERPROG
+#include <bitmap.h>
 #include "userprog/process.h"
 #include "malloc.h"
+#ifdef FILESYS
+#include "filesys/inode.h"
+#endif
 
 #endif
 
@@ -27,15 +32,28 @@
 #define THREAD_MAGIC 0xcd6abf4b
 
 
-static struct list file_list;
-
-
 /* The average load of system */
 fixed_point_t load_avg;
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, kept in one FIFO queue
+   per priority.  Bit P of ready_bitmap is set if and only if
+   ready_queues[P] is not empty, so the highest-priority ready
+   thread is found with a bit scan instead of a list walk. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+
+/* Number of threads in the ready queues. */
+static int ready_thread_cnt;
+
+/* MLFQS recent_cpu decay.  Each second every thread's recent_cpu
+   is scaled by a coefficient that depends on load_avg at that
+   moment.  The coefficients of the last DECAY_HISTORY seconds are
+   kept here, and a thread applies the ones it missed, counted by
+   its decay_seconds, only when it is next looked at. */
+#define DECAY_HISTORY 64
+static fixed_point_t decay_coef[DECAY_HISTORY];
+static int decay_seconds;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -87,6 +105,10 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static int ready_queue_highest (void);
+static void ready_queue_remove (struct thread *);
+static void thread_catch_up_recent_cpu (struct thread *);
+static void thread_mlfqs_second (void);
 
 
 struct child_message *thread_get_child_message(tid_t tid)
@@ -103,41 +125,89 @@ struct child_message *thread_get_child_message(tid_t tid)
 }
 
 
-/* For comparing two threads by their priorities.
-   Return true if a_ points to the thread with higher priority. */
-bool
-thread_priority_cmp (const struct list_elem *a_, const struct list_elem *b_,
-                      void *aux UNUSED)
-{
-  const struct thread *a = list_entry (a_, struct thread, elem);
-  const struct thread *b = list_entry (b_, struct thread, elem);
-
-  return thread_get_certain_priority (a) > thread_get_certain_priority (b);
-}
-
 /* Check if current thread need to yield
-   (its priority is lower than the first one in the ready list). */
+   (its priority is lower than the best one in the ready queues). */
 void
 thread_revolt (void)
 {
   if (thread_current () != idle_thread &&
-      !list_empty (&ready_list) &&
-      thread_get_priority () <
-      thread_get_certain_priority (
-              list_entry (list_begin (&ready_list), struct thread, elem)))
+      ready_bitmap != 0 &&
+      thread_get_priority () < ready_queue_highest ())
   {
-    thread_yield ();
+    if (intr_context ())
+      intr_yield_on_return ();
+    else
+      thread_yield ();
   }
 }
 
-/* Insert a thread to the ready list in order. */
+/* Insert a thread at the back of the ready queue for its priority.
+   Must be called with interrupts off. */
 void
 thread_insert_ready_list (struct list_elem *elem)
 {
-  if (!list_empty (&ready_list))
-    list_insert_ordered (&ready_list, elem, thread_priority_cmp, NULL);
+  struct thread *t = list_entry (elem, struct thread, elem);
+  int priority = thread_get_certain_priority (t);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    {
+      /* T may have slept through several per-second updates. */
+      thread_mlfqs_refresh (t);
+      priority = t->priority;
+    }
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->ready_priority = priority;
+  list_push_back (&ready_queues[priority], elem);
+  ready_bitmap |= (uint64_t) 1 << priority;
+  ready_thread_cnt++;
+}
+
+/* Called after T's effective priority may have changed.  If T is
+   waiting in a ready queue, moves it to the queue matching its
+   new priority; if it is waiting on a semaphore or condition,
+   puts it back in order there. */
+void
+thread_priority_changed (struct thread *t)
+{
+  enum intr_level old_level = intr_disable ();
+  if (t->status == THREAD_READY && t != idle_thread)
+    {
+      ready_queue_remove (t);
+      thread_insert_ready_list (&t->elem);
+    }
+  else if (t->status == THREAD_BLOCKED)
+    synch_priority_changed (t);
+  intr_set_level (old_level);
+}
+
+/* Returns the highest priority that has a ready thread.
+   At least one thread must be ready. */
+static int
+ready_queue_highest (void)
+{
+  uint32_t high = ready_bitmap >> 32;
+  uint32_t low = ready_bitmap;
+
+  ASSERT (ready_bitmap != 0);
+  if (high != 0)
+    return 63 - __builtin_clz (high);
   else
-    list_push_back (&ready_list, elem);
+    return 31 - __builtin_clz (low);
+}
+
+/* Takes ready thread T off its ready queue. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  list_remove (&t->elem);
+  ready_thread_cnt--;
+  if (list_empty (&ready_queues[t->ready_priority]))
+    ready_bitmap &= ~((uint64_t) 1 << t->ready_priority);
 }
 
 /* Initializes the threading system by transforming the code
@@ -156,17 +226,18 @@ thread_insert_ready_list (struct list_elem *elem)
 void
 thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_bitmap = 0;
   list_init (&all_list);
   list_init (&children);
 
 
-  list_init(&file_list);
-
-
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
@@ -390,19 +461,7 @@ thread_exit (void)
   sema_up (&thread_current ()->sema_finished);
 
   struct thread* cur = thread_current();
-  if (!list_empty(&file_list)){
-    struct list_elem* i;
-    for (i = list_begin(&file_list); i != list_end(&file_list); i = list_next(i)){
-      struct file_handle* hd;
-      hd = list_entry(i, struct file_handle, elem);
-      if (hd->owned_thread == cur){
-        syscall_file_close(hd->opened_file);
-        i = list_prev(i);
-        list_remove(&(hd->elem));
-        free(hd);
-      }
-    }
-  }
+  thread_fd_close_all();
   if(cur->exec_file != NULL){
     syscall_file_close(cur->exec_file);
   }
@@ -456,37 +515,21 @@ thread_foreach (thread_action_func *func, void *aux)
 }
 
 
-/* Handle blocking_ticks for each thread */
-static void
-thread_blocking_ticks_handler(struct thread *t, void *args UNUSED)
-{
-  if (t->blocking_ticks > 0)
-  {
-    (t->blocking_ticks)--;
-    if (!(t->blocking_ticks))
-      thread_unblock(t);
-  }
-}
-
-
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority (int new_priority)
 {
+  enum intr_level old_level;
+
   if (thread_mlfqs)
     return;
-  /* Warning: if current thread is donated,
-     this behaviour should be delayed until the donation is released! */
-  if (thread_current ()->max_donate == 0)
-  {
-    thread_current ()->priority = new_priority;
-    thread_revolt ();
-  }
-  else
-  {
-    /* Delay this behaviour temporarily. */
-    thread_current ()->priority_to_set = new_priority;
-  }
+  /* A donated priority stays in effect until the donation is
+     released, even if it is now below the new base priority. */
+  old_level = intr_disable ();
+  thread_current ()->priority = new_priority;
+  thread_refresh_priority (thread_current ());
+  intr_set_level (old_level);
+  thread_revolt ();
 }
 
 /* Returns the current thread's priority. */
@@ -500,7 +543,51 @@ thread_get_priority (void)
 int
 thread_get_certain_priority (const struct thread *t)
 {
-  return t->priority + (thread_mlfqs ? 0 : t->max_donate) ;
+  return thread_mlfqs ? t->priority : t->eff_priority;
+}
+
+/* Recomputes T's effective priority as the higher of its base
+   priority and the priorities donated through the locks it
+   holds.  Must be called with interrupts off. */
+void
+thread_refresh_priority (struct thread *t)
+{
+  int priority = t->priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->lock_list); e != list_end (&t->lock_list);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->max_priority > priority)
+        priority = lock->max_priority;
+    }
+  if (priority != t->eff_priority)
+    {
+      t->eff_priority = priority;
+      thread_priority_changed (t);
+    }
+}
+
+/* Recomputes T's MLFQS priority from its recent_cpu and nice
+   value, first applying any recent_cpu decay it has missed.
+   Does not move T between ready queues. */
+void
+thread_mlfqs_refresh (struct thread *t)
+{
+  int priority;
+
+  if (t == idle_thread)
+    return;
+  thread_catch_up_recent_cpu (t);
+  priority = PRI_MAX - fix_trunc (fix_unscale (t->recent_cpu, 4)) - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->priority = priority;
 }
 
 /* Update thread priority using recent_cpu and nice value of threads */
@@ -508,18 +595,16 @@ static void
 thread_update_priority(struct thread* t, void *args UNUSED){
   if(t == idle_thread)
     return;
-  int recent_cpu_div4 = fix_trunc(fix_unscale(t->recent_cpu, 4));
-  t->priority =  PRI_MAX - recent_cpu_div4 - t->nice * 2;
-}
-
-void thread_ready_list_sort(void){
-  list_sort(&ready_list, thread_priority_cmp, NULL);
+  thread_mlfqs_refresh (t);
+  thread_priority_changed(t);
 }
 
 /* Sets the current thread's nice value to NICE. */
 void
 thread_set_nice (int nice)
 {
+  if (thread_mlfqs)
+    thread_catch_up_recent_cpu (thread_current ());
   thread_current()->nice = nice;
   if(thread_mlfqs){
     thread_update_priority(thread_current(), NULL);
@@ -537,22 +622,15 @@ thread_get_nice (void)
 
 /* Update load_avg
  * load_avg = 59/60 * load_avg + 1/60 * ready_threads
+ * ready_threads is kept up to date by the ready queues, so this
+ * does not have to look at every thread.
  * */
 static void
 thread_update_load_avg(void)
 {
-
   ASSERT(thread_mlfqs);
-  int ready_threads = 0;
-  struct list_elem *e;
-  for (e = list_begin (&all_list); e != list_end (&all_list);
-       e = list_next (e))
-  {
-    struct thread *t = list_entry (e, struct thread, allelem);
-    if ((t->status == THREAD_RUNNING || t->status == THREAD_READY) && t != idle_thread)
-      ready_threads++;
-  }
-  load_avg = fix_add(fix_unscale(fix_scale(load_avg, 59), 60), fix_unscale(fix_int(ready_threads), 60));
+  int ready = ready_thread_cnt + (thread_current () != idle_thread);
+  load_avg = fix_add(fix_unscale(fix_scale(load_avg, 59), 60), fix_unscale(fix_int(ready), 60));
 }
 
 /* Returns 100 times the system load average. */
@@ -563,7 +641,7 @@ thread_get_load_avg (void)
   return fix_round(fix_scale(load_avg, 100));
 }
 
-/* Add recent_cpu of the running thread by 1 per second */
+/* Add recent_cpu of the running thread by 1 per tick */
 void thread_add_recent_cpu(void)
 {
   ASSERT(thread_mlfqs);
@@ -573,17 +651,50 @@ void thread_add_recent_cpu(void)
   thread_update_priority(thread_current(), NULL);
 }
 
+/* Returns C raised to the K-th power. */
+static fixed_point_t
+decay_power (fixed_point_t c, int k)
+{
+  fixed_point_t result = fix_int (1);
 
-/* Update recent_cpu
+  for (; k > 0; k >>= 1)
+    {
+      if (k & 1)
+        result = fix_mul (result, c);
+      c = fix_mul (c, c);
+    }
+  return result;
+}
+
+/* Applies to T every per-second recent_cpu update
  * recent_cpu = recent_cpu * (load_avg * 2 / (load_avg * 2 + 1)) + nice
- * Nice is thread's nice value
+ * that happened since T's recent_cpu was last brought up to date.
+ * Updates older than DECAY_HISTORY seconds are applied in closed
+ * form with the oldest recorded coefficient.
  * */
 static void
-thread_update_recent_cpu(struct thread *t, void* aux UNUSED)
+thread_catch_up_recent_cpu (struct thread *t)
 {
+  int missed = decay_seconds - t->decay_seconds;
+
   ASSERT(thread_mlfqs);
-  int load_avg2 = thread_get_load_avg() * 2;
-   t->recent_cpu = fix_add(fix_mul(fix_div(fix_scale(load_avg, 2), fix_add(fix_scale(load_avg, 2), fix_int(1))),t->recent_cpu), fix_int(t->nice));
+  if (missed > DECAY_HISTORY)
+    {
+      int excess = missed - DECAY_HISTORY;
+      fixed_point_t c = decay_coef[decay_seconds % DECAY_HISTORY];
+      fixed_point_t ck = decay_power (c, excess);
+
+      /* r * c**k + nice * (1 + c + ... + c**(k-1)). */
+      t->recent_cpu = fix_add (fix_mul (ck, t->recent_cpu),
+                               fix_mul (fix_int (t->nice),
+                                        fix_div (fix_sub (fix_int (1), ck),
+                                                 fix_sub (fix_int (1), c))));
+      t->decay_seconds += excess;
+    }
+  for (; t->decay_seconds < decay_seconds; t->decay_seconds++)
+    t->recent_cpu = fix_add (fix_mul (decay_coef[t->decay_seconds % DECAY_HISTORY],
+                                      t->recent_cpu),
+                             fix_int (t->nice));
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
@@ -591,23 +702,66 @@ int
 thread_get_recent_cpu (void)
 {
   ASSERT(thread_mlfqs);
+  thread_catch_up_recent_cpu (thread_current ());
   return fix_round(fix_scale(thread_current()->recent_cpu, 100));
   
 }
 
+/* Returns the number of once-a-second MLFQS updates so far.  The
+   priorities of blocked threads may be stale by as many seconds
+   as this has moved on since they last ran. */
+int
+thread_mlfqs_seconds (void)
+{
+  return decay_seconds;
+}
+
+/* Once-a-second MLFQS update.  Records this second's recent_cpu
+   decay instead of applying it to every thread: blocked threads
+   catch up when they are woken.  Only the running thread and the
+   threads sitting in ready queues, whose position depends on their
+   priority, are brought up to date now.  Semaphores and condition
+   variables refresh their waiters themselves before choosing one
+   to wake (see synch.c). */
+static void
+thread_mlfqs_second (void)
+{
+  int pri;
+
+  thread_update_load_avg ();
+  decay_coef[decay_seconds % DECAY_HISTORY]
+    = fix_div (fix_scale (load_avg, 2),
+               fix_add (fix_scale (load_avg, 2), fix_int (1)));
+  decay_seconds++;
+
+  thread_update_priority (thread_current (), NULL);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    {
+      struct list_elem *e, *next;
+
+      for (e = list_begin (&ready_queues[pri]);
+           e != list_end (&ready_queues[pri]); e = next)
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+
+          next = list_next (e);
+          thread_mlfqs_refresh (t);
+          if (t->priority != t->ready_priority)
+            {
+              ready_queue_remove (t);
+              thread_insert_ready_list (&t->elem);
+            }
+        }
+    }
+}
 
 void
 thread_timer(bool full_second){
   if (thread_mlfqs){
     thread_add_recent_cpu();
-    if (full_second){
-      thread_update_load_avg();
-      thread_foreach(thread_update_recent_cpu, NULL);
-      thread_foreach(thread_update_priority, NULL);
-      thread_ready_list_sort();
-    }
+    if (full_second)
+      thread_mlfqs_second ();
   }
-  thread_foreach(thread_blocking_ticks_handler, NULL);
 }
 
 
@@ -632,6 +786,7 @@ idle (void *idle_started_ UNUSED)
     /* Let someone else run. */
     intr_disable ();
     thread_block ();
+    timer_idle_enter ();
 
     /* Re-enable interrupts and wait for the next one.
 
@@ -702,13 +857,13 @@ init_thread (struct thread *t, const char *name, int priority)
   if(thread_mlfqs) {
     t->nice = 0;
     t->recent_cpu = fix_int(0);
+    t->decay_seconds = decay_seconds;
     t->priority =  PRI_MAX;
   }
 
   list_init (&t->lock_list);
-  t->priority_to_set = -1;
-  t->max_donate = 0;
-  t->father = NULL;
+  t->eff_priority = t->priority;
+  t->waiting_lock = NULL;
 
 
   t->return_value = 0;
@@ -719,9 +874,11 @@ init_thread (struct thread *t, const char *name, int priority)
   list_init (&t->child_list);
   sema_init (&t->sema_finished, 0);
   sema_init (&t->sema_started, 0);
+#ifdef VM
+  list_init (&t->mmap_list);
+#endif
 
   old_level = intr_disable ();
-  //list_insert_ordered (&all_list,  &t->allelem, thread_priority_cmp, NULL);
   list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
@@ -747,10 +904,14 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  struct thread *t;
+
+  if (ready_bitmap == 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  t = list_entry (list_front (&ready_queues[ready_queue_highest ()]),
+                  struct thread, elem);
+  ready_queue_remove (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -781,6 +942,8 @@ thread_schedule_tail (struct thread *prev)
 
   /* Start new time slice. */
   thread_ticks = 0;
+  if (prev != NULL && prev == idle_thread)
+    timer_idle_exit ();
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -850,9 +1013,126 @@ thread_exit_with_return_value(struct intr_frame *f, int return_value) {
   thread_exit();
 }
 
+#ifdef USERPROG
+/* Gives FH the lowest free file descriptor of the current
+   process and returns it, doubling the process's fd table when it
+   is full.  Returns -1 if memory runs out.
+   Descriptor FD lives in slot FD - FD_BASE of the table, since
+   0 and 1 are the console. */
+int
+thread_fd_alloc(struct file_handle* fh){
+  struct thread* cur = thread_current();
+  size_t slot = cur->fd_map != NULL
+                ? bitmap_scan_and_flip(cur->fd_map, 0, 1, false)
+                : BITMAP_ERROR;
+
+  if (slot == BITMAP_ERROR){
+    size_t cap = cur->fd_cap != 0 ? cur->fd_cap * 2 : FD_TABLE_MIN;
+    struct file_handle** table = realloc(cur->fd_table, cap * sizeof *table);
+    struct bitmap* map = bitmap_create(cap);
+    size_t i;
+
+    if (table == NULL || map == NULL){
+      bitmap_destroy(map);
+      if (table != NULL)
+        cur->fd_table = table;
+      return -1;
+    }
+    for (i = cur->fd_cap; i < cap; i++)
+      table[i] = NULL;
+    for (i = 0; i < cur->fd_cap; i++)
+      bitmap_set(map, i, table[i] != NULL);
+    slot = cur->fd_cap;
+    bitmap_mark(map, slot);
+    bitmap_destroy(cur->fd_map);
+    cur->fd_table = table;
+    cur->fd_map = map;
+    cur->fd_cap = cap;
+  }
+
+  cur->fd_table[slot] = fh;
+  fh->fd = slot + FD_BASE;
+  return fh->fd;
+}
+
+/* Frees file descriptor FD of the current process, which must be
+   in use.  Does not close the file. */
+void
+thread_fd_free(int fd){
+  struct thread* cur = thread_current();
+  size_t slot = fd - FD_BASE;
+
+  ASSERT(syscall_get_file_handle(fd) != NULL);
+  cur->fd_table[slot] = NULL;
+  bitmap_reset(cur->fd_map, slot);
+}
+
+/* Closes every file the current process still has open and
+   frees its fd table. */
 void
-thread_file_list_inster(struct file_handle* fh){
-  list_push_back(&file_list, &(fh->elem));
+thread_fd_close_all(void){
+  struct thread* cur = thread_current();
+  size_t i;
+
+  for (i = 0; i < cur->fd_cap; i++){
+    struct file_handle* hd = cur->fd_table[i];
+    if (hd == NULL)
+      continue;
+#ifdef FILESYS
+    if (inode_isdir(file_get_inode(hd->opened_file)))
+      dir_close(hd->opened_dir);
+#endif
+    syscall_file_close(hd->opened_file);
+    free(hd);
+  }
+  free(cur->fd_table);
+  bitmap_destroy(cur->fd_map);
+  cur->fd_table = NULL;
+  cur->fd_map = NULL;
+  cur->fd_cap = 0;
+}
+
+/* Gives the current process, forked from FROM, the fds of FROM,
+   each referring to the same file opened anew at the same
+   position.  Returns false if memory runs out; what was copied
+   is then left for thread_fd_close_all. */
+bool
+thread_fd_copy(struct thread *from){
+  struct thread* cur = thread_current();
+  size_t i;
+
+  ASSERT(cur->fd_cap == 0);
+  if (from->fd_cap == 0)
+    return true;
+  cur->fd_table = calloc(from->fd_cap, sizeof *cur->fd_table);
+  cur->fd_map = bitmap_create(from->fd_cap);
+  if (cur->fd_table == NULL || cur->fd_map == NULL)
+    return false;
+  cur->fd_cap = from->fd_cap;
+
+  for (i = 0; i < from->fd_cap; i++){
+    struct file_handle* hd = from->fd_table[i];
+    struct file_handle* copy;
+    if (hd == NULL)
+      continue;
+    copy = malloc(sizeof *copy);
+    if (copy == NULL)
+      return false;
+    copy->fd = hd->fd;
+    copy->opened_file = file_reopen(hd->opened_file);
+    if (copy->opened_file == NULL){
+      free(copy);
+      return false;
+    }
+    file_seek(copy->opened_file, file_tell(hd->opened_file));
+#ifdef FILESYS
+    if (inode_isdir(file_get_inode(copy->opened_file)))
+      copy->opened_dir = dir_reopen(hd->opened_dir);
+#endif
+    cur->fd_table[i] = copy;
+    bitmap_mark(cur->fd_map, i);
+  }
+  return true;
 }
 
 /* Get the file_handle pointer according to fd
@@ -860,19 +1140,13 @@ thread_file_list_inster(struct file_handle* fh){
  * */
 struct file_handle* syscall_get_file_handle(int fd){
   struct thread* cur =  thread_current();
-  struct list_elem* i;
-  for (i = list_begin(&file_list); i != list_end(&file_list); i = list_next(i)){
-    struct file_handle* t;
-    t = list_entry(i, struct file_handle, elem);
-    if (t->fd == fd){
-      if (t->owned_thread != cur)
-        return NULL;
-      else
-        return t;
-    }
-  }
-  return NULL;
+  size_t slot = (size_t) fd - FD_BASE;
+
+  if (fd < FD_BASE || slot >= cur->fd_cap)
+    return NULL;
+  return cur->fd_table[slot];
 }
+#endif
 
 
 
@@ -36,6 +36,10 @@ typedef int mapid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* User memory ranges one system call pins: its number, its
+   arguments and a buffer or string. */
+#define SYSCALL_PIN_MAX 4
+
 
 struct thread;
 
@@ -104,12 +108,9 @@ struct child_message
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in a run queue (thread.c).  A
+   thread blocked on a semaphore sits in the semaphore's waiter
+   heap through `wait_elem' instead (synch.c). */
 struct thread
 {
     /* Owned by thread.c. */
@@ -120,20 +121,26 @@ struct thread
 
     int nice;                           /* The nice level of thread, the higher the lower priority */
     fixed_point_t recent_cpu; /* Thread recent cpu usage */
+    int decay_seconds;                  /* Seconds of decay applied to recent_cpu. */
     int priority;                       /* Priority. */
-    int64_t blocking_ticks;                /* Ticks that the thread to block. */
+    int ready_priority;                 /* Ready queue the thread is on. */
 
     struct list lock_list;              /* Locks owned by this thread. */
-    int priority_to_set;                /* Priority to be set. */
-    int max_donate;                     /* Max Donation. */
-    struct thread *father;              /* Thread who locks this thread. */
-    struct list_elem donate_elem;       /* List element for donation list of locks. */
+    int eff_priority;                   /* Priority including donations. */
+    struct lock *waiting_lock;          /* Lock being waited on, if any. */
 
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by synch.c. */
+    struct pheap_elem wait_elem;        /* Element in a semaphore's waiters. */
+    unsigned wait_seq;                  /* Arrival order among equal priorities. */
+    struct semaphore *waiting_sema;     /* Semaphore being waited on, if any. */
+    struct condition *waiting_cond;     /* Condition being waited on, if any. */
+    struct pheap_elem *cond_elem;       /* Our element in waiting_cond's waiters. */
+
 
     int return_value;                   /* Return value of the thread (anyway, nobody cares)*/
 
@@ -152,9 +159,29 @@ struct thread
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
     struct file* exec_file;
+    struct file_handle **fd_table;      /* Open files, by fd - FD_BASE. */
+    struct bitmap *fd_map;              /* Slots of FD_TABLE in use. */
+    size_t fd_cap;                      /* Number of slots in FD_TABLE. */
 #endif
 #ifdef FILESYS
     struct dir *current_dir;
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct page_table *page_table;      /* Supplemental page table. */
+    void *user_esp;                     /* User esp at the last syscall,
+                                           for faults in the kernel. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list mmap_list;              /* Files mapped by mmap. */
+    int next_mapid;                     /* Id of the next mapping. */
+    const void *pin_addr[SYSCALL_PIN_MAX]; /* User pages pinned by the */
+    size_t pin_pages[SYSCALL_PIN_MAX];  /* current system call, as runs */
+    int pin_cnt;                        /* of PIN_PAGES from PIN_ADDR. */
+
+    /* Owned by vm/swap.c. */
+    size_t swap_next;                   /* Next free slot of the swap cluster. */
+    size_t swap_end;                    /* End of the swap cluster. */
 #endif
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
@@ -162,14 +189,18 @@ struct thread
 };
 
 
+/* First file descriptor handed out for a file; 0 and 1 are the
+   console.  A process's fd table starts with FD_TABLE_MIN slots
+   and doubles when it fills up. */
+#define FD_BASE 2
+#define FD_TABLE_MIN 16
+
 struct file_handle{
     int fd;
     struct file* opened_file;
-    struct thread* owned_thread;
 #ifdef FILESYS
     struct dir* opened_dir;
 #endif 
-    struct list_elem elem;
 };
 
 
@@ -182,10 +213,11 @@ struct child_message *thread_get_child_message(tid_t tid);
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
-bool thread_priority_cmp (const struct list_elem *a_, const struct list_elem *b_,
-                           void *aux UNUSED);
 void thread_revolt (void);
 void thread_insert_ready_list (struct list_elem *elem);
+void thread_priority_changed (struct thread *t);
+void thread_mlfqs_refresh (struct thread *t);
+int thread_mlfqs_seconds (void);
 
 void thread_init (void);
 void thread_start (void);
@@ -209,28 +241,31 @@ void thread_yield (void);
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
-static void thread_blocking_ticks_handler(struct thread *t, void *args UNUSED);
 
 int thread_get_priority (void);
 int thread_get_certain_priority (const struct thread *t);
 void thread_set_priority (int);
+void thread_refresh_priority (struct thread *t);
 static void thread_update_priority(struct thread*, void*);
-void thread_ready_list_sort(void);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 static void thread_update_load_avg(void);
-static void thread_update_recent_cpu(struct thread*, void*);
 void thread_add_recent_cpu(void);
 
 
 void thread_timer(bool);
 void thread_exit_with_return_value(struct intr_frame *f, int return_value);
 
-void thread_file_list_inster(struct file_handle* fh);
+#ifdef USERPROG
+int thread_fd_alloc(struct file_handle* fh);
+void thread_fd_free(int fd);
+void thread_fd_close_all(void);
+bool thread_fd_copy(struct thread *from);
 struct file_handle* syscall_get_file_handle(int fd);
+#endif
 
 #ifdef FILESYS
 void set_main_thread_dir();
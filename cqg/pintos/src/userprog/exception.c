@@ -163,6 +163,19 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring the page in.  Faults in the kernel come from system
+     calls touching user memory, so the user esp is the one
+     saved when the system call started.  Writes to present
+     pages may hit a copy-on-write page shared with a forked
+     process. */
+  if ((not_present || write) && is_user_vaddr (fault_addr)
+      && page_page_fault_handler (fault_addr, write,
+                                  user ? f->esp : thread_current ()->user_esp))
+    return;
+  if (user || is_user_vaddr (fault_addr))
+    thread_exit_with_return_value (f, -1);
+#endif
 
 
 	printf ("Page fault at %p: %s error %s page in %s context.\n",
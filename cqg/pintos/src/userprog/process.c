@@ -25,6 +25,16 @@
 #endif
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+
+/* What the child of process_fork() needs from its parent. */
+struct fork_args
+  {
+    struct thread *parent;              /* The forking process. */
+    struct intr_frame if_;              /* Its system call frame. */
+  };
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 
@@ -150,6 +160,80 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Starts a copy of the current process, which resumes from the
+   system call in F just like it, but gets 0 back.  The two
+   share their writable pages copy-on-write, and the child gets
+   the parent's open files, each opened anew at the same
+   position.  Waits for the copy to be made and returns the
+   child's thread id, or TID_ERROR if it could not be. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_args args;
+  struct child_message *l;
+  tid_t tid;
+
+  args.parent = thread_current ();
+  args.if_ = *f;
+  tid = thread_create (args.parent->name, PRI_DEFAULT, start_fork, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  l = thread_get_child_message (tid);
+  list_push_back (&args.parent->child_list, &l->elem);
+
+  /* ARGS lives on our stack until the child is done with it. */
+  sema_down (l->sema_started);
+  return l->load_failed ? TID_ERROR : tid;
+}
+
+/* A thread function that copies the process forking it and
+   starts the copy running. */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = args->parent;
+  struct intr_frame if_ = args->if_;
+  bool success = false;
+
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir != NULL)
+  {
+    process_activate ();
+    cur->page_table = page_create ();
+    success = cur->page_table != NULL
+              && mmap_fork (parent)
+              && page_fork (parent)
+              && thread_fd_copy (parent);
+  }
+  if (success && parent->exec_file != NULL)
+  {
+    cur->exec_file = file_reopen (parent->exec_file);
+    if (cur->exec_file != NULL)
+      file_deny_write (cur->exec_file);
+    else
+      success = false;
+  }
+
+  if (!success)
+  {
+    cur->message_to_grandpa->load_failed = true;
+    cur->message_to_grandpa->return_value = -1;
+    cur->return_value = -1;
+  }
+  sema_up (cur->message_to_grandpa->sema_started);
+  if (!success)
+    thread_exit ();
+
+  /* Return 0 from fork(). */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -208,6 +292,18 @@ process_exit (void)
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
+#ifdef VM
+  /* Write back mapped files and give back frames and swap slots
+     while the page directory still maps them. */
+  if (cur->page_table != NULL)
+  {
+    syscall_unpin_all ();
+    mmap_unmap_all (cur);
+    page_destroy (cur->page_table);
+    cur->page_table = NULL;
+  }
+#endif
+
   pd = cur->pagedir;
   if (pd != NULL)
   {
@@ -338,6 +434,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (t->pagedir == NULL)
     goto done;
   process_activate ();
+#ifdef VM
+  t->page_table = page_create ();
+  if (t->page_table == NULL)
+    goto done;
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -445,7 +546,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -563,8 +666,22 @@ setup_stack (void **esp)
   uint8_t *kpage;
   bool success = false;
 
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
 
-
+  kpage = frame_get_frame (PAL_ZERO, upage);
+  if (kpage != NULL)
+  {
+    success = page_set_frame (upage, kpage, true);
+    if (success)
+    {
+      *esp = PHYS_BASE;
+      frame_set_pinned_false (kpage);
+    }
+    else
+      frame_free_frame (kpage);
+  }
+#else
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
 
   if (kpage != NULL)
@@ -575,9 +692,11 @@ setup_stack (void **esp)
     else
       palloc_free_page (kpage);
   }
+#endif
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -598,6 +717,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 
 
@@ -17,6 +17,11 @@
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #endif
+#ifdef VM
+#include <round.h>
+#include <string.h>
+#include "vm/page.h"
+#endif
 
 static void syscall_handler(struct intr_frame *);
 
@@ -37,8 +42,6 @@ static void syscall_close(struct intr_frame *f, int fd);
 bool syscall_check_user_string(const char *str);
 bool syscall_check_user_buffer (const char *str, int size, bool write);
 
-static struct lock filesys_lock;
-
 #ifdef FILESYS
 static void syscall_chdir(struct intr_frame *f, const char *dir);
 static void syscall_mkdir(struct intr_frame *f, const char *dir);
@@ -47,30 +50,39 @@ static void syscall_isdir(struct intr_frame *f, int fd);
 static void syscall_inumber(struct intr_frame *f, int fd);
 #endif
 
+#ifdef VM
+static void syscall_mmap(struct intr_frame *f, int fd, void *addr);
+static void syscall_munmap(struct intr_frame *f, mapid_t mapid);
+static struct mmap_handler *mmap_create(struct thread *cur, struct file *file,
+                                        off_t ofs, void *addr,
+                                        uint32_t read_bytes, int num_page,
+                                        bool writable, bool is_static_data);
+static void mmap_unmap(struct thread *cur, struct mmap_handler *mh);
+static void syscall_fork(struct intr_frame *f);
+#endif
+
 
 void
 syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesys_lock);
 }
 
 void syscall_file_close(struct file* file){
-  lock_acquire(&filesys_lock);
   file_close(file);
-  lock_release(&filesys_lock);
 }
 
 struct file* syscall_file_open(const char * name){
-  lock_acquire(&filesys_lock);
   struct file* tmp = filesys_open(name);
-  lock_release(&filesys_lock);
   return tmp;
 }
 
 static void
 syscall_handler (struct intr_frame *f UNUSED)
 {
+#ifdef VM
+  thread_current()->user_esp = f->esp;
+#endif
   if (!syscall_check_user_buffer(f->esp, 4, false))
     thread_exit_with_return_value(f, -1);
 
@@ -92,6 +104,9 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_MKDIR:
     case SYS_ISDIR:
     case SYS_INUMBER:
+#endif
+#ifdef VM
+    case SYS_MUNMAP:
 #endif
       if (!syscall_check_user_buffer(arg1, 4, false))
         thread_exit_with_return_value(f, -1);
@@ -101,6 +116,9 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_SEEK:
 #ifdef FILESYS
     case SYS_READDIR:
+#endif
+#ifdef VM
+    case SYS_MMAP:
 #endif
       if (!syscall_check_user_buffer(arg1, 8, false))
         thread_exit_with_return_value(f, -1);
@@ -174,6 +192,20 @@ syscall_handler (struct intr_frame *f UNUSED)
       syscall_inumber(f, *((int *) arg1));
       break;
 
+#endif
+#ifdef VM
+    case SYS_MMAP:
+      syscall_mmap(f, *((int *) arg1), *((void **) arg2));
+      break;
+
+    case SYS_MUNMAP:
+      syscall_munmap(f, *((mapid_t *) arg1));
+      break;
+
+    case SYS_FORK:
+      syscall_fork(f);
+      break;
+
 #endif
     case SYS_CREATE:
       syscall_create(f, *((void **) arg1), *((unsigned *) arg2));
@@ -195,7 +227,9 @@ syscall_handler (struct intr_frame *f UNUSED)
     default:
       thread_exit_with_return_value(f, -1);
   }
-
+#ifdef VM
+  syscall_unpin_all();
+#endif
 }
 
 
@@ -205,9 +239,7 @@ syscall_exec (struct intr_frame *f, const char *cmd_line)
 {
   if (!syscall_check_user_string(cmd_line))
     thread_exit_with_return_value(f, -1);
-  lock_acquire(&filesys_lock);
   f->eax = (uint32_t)process_execute (cmd_line);
-  lock_release(&filesys_lock);
   struct list_elem *e;
   struct thread *cur = thread_current ();
   struct child_message *l;
@@ -259,26 +291,25 @@ static void
 syscall_open(struct intr_frame *f, const char* name){
   if (!syscall_check_user_string(name))
     thread_exit_with_return_value(f, -1);
-  lock_acquire(&filesys_lock);
   struct file* tmp_file = filesys_open(name);
-  lock_release(&filesys_lock);
   if (tmp_file == NULL){
     f->eax = (uint32_t)-1;
     return;
   }
 
-  static uint32_t fd_next = 2;
-
   struct file_handle* handle = malloc(sizeof(struct file_handle));
+  if (handle == NULL || thread_fd_alloc(handle) == -1){
+    free(handle);
+    file_close(tmp_file);
+    f->eax = (uint32_t)-1;
+    return;
+  }
   handle->opened_file = tmp_file;
-  handle->owned_thread = thread_current();
-  handle->fd = fd_next++;
 
 #ifdef FILESYS
   if (inode_isdir(file_get_inode(tmp_file)))
     handle->opened_dir = dir_open(inode_reopen(file_get_inode(tmp_file)));
 #endif
-  thread_file_list_inster(handle);
   f->eax = (uint32_t)handle->fd;
 }
 
@@ -287,27 +318,21 @@ syscall_create(struct intr_frame *f, const char * name, unsigned initial_size){
   if (!syscall_check_user_string(name))
     thread_exit_with_return_value(f, -1);
 
-  lock_acquire(&filesys_lock);
   f->eax = (uint32_t)filesys_create(name, initial_size);
-  lock_release(&filesys_lock);
 }
 
 static void
 syscall_remove(struct intr_frame *f, const char* name){
   if (!syscall_check_user_string(name))
     thread_exit_with_return_value(f, -1);
-  lock_acquire(&filesys_lock);
   f->eax = (uint32_t)filesys_remove(name);
-  lock_release(&filesys_lock);
 }
 
 static void
 syscall_filesize(struct intr_frame *f, int fd){
   struct file_handle* t = syscall_get_file_handle(fd);
   if(t != NULL){
-    lock_acquire(&filesys_lock);
     f->eax = (uint32_t)file_length(t->opened_file);
-    lock_release(&filesys_lock);
   }
 
   else
@@ -330,9 +355,7 @@ syscall_read(struct intr_frame *f, int fd, const void* buffer, unsigned size){
   else{
     struct file_handle* t = syscall_get_file_handle(fd);
     if (t != NULL && !inode_isdir(file_get_inode(t->opened_file))){
-      lock_acquire(&filesys_lock);
       f->eax = (uint32_t)file_read(t->opened_file, (void*)buffer, size);
-      lock_release(&filesys_lock);
     }
     else
       thread_exit_with_return_value(f, -1);
@@ -352,9 +375,7 @@ syscall_write(struct intr_frame *f, int fd, const void* buffer, unsigned size){
   else{
     struct file_handle* t = syscall_get_file_handle(fd);
     if (t != NULL && !inode_isdir(file_get_inode(t->opened_file))){
-      lock_acquire(&filesys_lock);
       f->eax = (uint32_t)file_write(t->opened_file, (void*)buffer, size);
-      lock_release(&filesys_lock);
     }
     else
       thread_exit_with_return_value(f, -1);
@@ -365,9 +386,7 @@ static void
 syscall_seek(struct intr_frame *f, int fd, unsigned position){
   struct file_handle* t = syscall_get_file_handle(fd);
   if (t != NULL){
-    lock_acquire(&filesys_lock);
     file_seek(t->opened_file, position);
-    lock_release(&filesys_lock);
   }
 
   else
@@ -378,9 +397,7 @@ static void
 syscall_tell(struct intr_frame *f, int fd){
   struct file_handle* t = syscall_get_file_handle(fd);
   if (t != NULL && !inode_isdir(file_get_inode(t->opened_file))){
-    lock_acquire(&filesys_lock);
     f->eax = (uint32_t)file_tell(t->opened_file);
-    lock_release(&filesys_lock);
   }
   else
     thread_exit_with_return_value(f, -1);
@@ -390,15 +407,12 @@ static void
 syscall_close(struct intr_frame *f, int fd){
   struct file_handle* t = syscall_get_file_handle(fd);
   if(t != NULL){
-    lock_acquire(&filesys_lock);
-
 #ifdef FILESYS
     if (inode_isdir(file_get_inode(t->opened_file)))
       dir_close(t->opened_dir);
 #endif
     file_close(t->opened_file);
-    lock_release(&filesys_lock);
-    list_remove(&t->elem);
+    thread_fd_free(fd);
     free(t);
   }
   else
@@ -406,9 +420,64 @@ syscall_close(struct intr_frame *f, int fd){
 }
 
 
+/* Starts a range of user pages for syscall_check_page(), from
+   the page of UADDR.  In the VM kernel the pages checked into it
+   are pinned until the system call returns, so that the kernel
+   never faults on them, possibly with file system locks held. */
+static int
+syscall_pin_begin(const void *uaddr UNUSED){
+#ifdef VM
+  struct thread *cur = thread_current();
+
+  ASSERT(cur->pin_cnt < SYSCALL_PIN_MAX);
+  cur->pin_addr[cur->pin_cnt] = pg_round_down(uaddr);
+  cur->pin_pages[cur->pin_cnt] = 0;
+  return cur->pin_cnt++;
+#else
+  return 0;
+#endif
+}
+
+/* Checks that the page of UADDR, the next page of range SLOT, is
+   mapped, and writable if WRITE is true.  In the VM kernel the
+   page is brought in and pinned. */
+static bool
+syscall_check_page(int slot UNUSED, const void *uaddr, bool write){
+#ifdef VM
+  struct thread *cur = thread_current();
+
+  if (uaddr == NULL || !is_user_vaddr(uaddr)
+      || !page_pin(uaddr, write, cur->user_esp))
+    return false;
+  cur->pin_pages[slot]++;
+  return true;
+#else
+  return syscall_translate_vaddr(uaddr, write);
+#endif
+}
+
+#ifdef VM
+/* Unpins the user pages pinned by the checks of the current
+   system call.  Used when it returns, and when the process exits
+   in the middle of it. */
+void
+syscall_unpin_all(void){
+  struct thread *cur = thread_current();
+  int i;
+  size_t j;
+
+  for (i = 0; i < cur->pin_cnt; i++)
+    for (j = 0; j < cur->pin_pages[i]; j++)
+      page_unpin((uint8_t *) cur->pin_addr[i] + j * PGSIZE);
+  cur->pin_cnt = 0;
+}
+#endif
+
 bool
 syscall_check_user_string(const char *ustr){
-  if (!syscall_translate_vaddr(ustr, false))
+  int slot = syscall_pin_begin(ustr);
+
+  if (!syscall_check_page(slot, ustr, false))
     return false;
   int cnt = 0;
   while(*ustr != '\0'){
@@ -419,7 +488,7 @@ syscall_check_user_string(const char *ustr){
     cnt++;
     ustr++;
     if (((int)ustr & PGMASK) == 0){
-      if (!syscall_translate_vaddr(ustr, false))
+      if (!syscall_check_page(slot, ustr, false))
         return false;
     }
   }
@@ -428,16 +497,17 @@ syscall_check_user_string(const char *ustr){
 
 bool
 syscall_check_user_buffer(const char* ustr, int size, bool write){
-  if (!syscall_translate_vaddr(ustr + size - 1, write))
-    return false;
+  const char *first = pg_round_down(ustr);
+  const char *last = pg_round_down(ustr + (size > 0 ? size - 1 : 0));
+  const char *page;
+  int slot = syscall_pin_begin(ustr);
 
-  size >>= 12;
-  do{
-    if (!syscall_translate_vaddr(ustr, write))
+  for (page = first; ; page += PGSIZE){
+    if (!syscall_check_page(slot, page == first ? ustr : page, write))
       return false;
-    ustr += 1 << 12;
-  }while(size--);
-  return true;
+    if (page == last)
+      return true;
+  }
 }
 
 /* Transfer user Vaddr to kernel vaddr
@@ -448,7 +518,16 @@ syscall_translate_vaddr(const void *vaddr, bool write){
   if (vaddr == NULL || !is_user_vaddr(vaddr))
     return false;
   ASSERT(vaddr != NULL);
+#ifdef VM
+  /* Bring in pages not yet read or evicted, as a fault would,
+     and refuse to write to read-only ones. */
+  if (!page_pin(vaddr, write, thread_current()->user_esp))
+    return false;
+  page_unpin(pg_round_down(vaddr));
+  return true;
+#else
   return pagedir_get_page(thread_current()->pagedir, vaddr) != NULL;
+#endif
 
 }
 
@@ -530,7 +609,7 @@ static void
 syscall_readdir(struct intr_frame *f, int fd, char *name)
 {
   if (fd == 0 || fd == 1
-              || !syscall_check_user_buffer(name, READDIR_MAX_LEN + 1, false))
+              || !syscall_check_user_buffer(name, READDIR_MAX_LEN + 1, true))
   {
     f->eax = false;
     return;
@@ -574,3 +653,234 @@ syscall_inumber(struct intr_frame *f, int fd)
 }
 
 #endif
+
+
+
+#ifdef VM
+
+static void
+syscall_mmap(struct intr_frame *f, int fd, void *addr)
+{
+  struct thread *cur = thread_current();
+  struct file_handle *fh = syscall_get_file_handle(fd);
+  struct mmap_handler *mh;
+  off_t length;
+
+  f->eax = (uint32_t) MAP_FAILED;
+  if (fh == NULL || addr == NULL || pg_ofs(addr) != 0
+#ifdef FILESYS
+      || inode_isdir(file_get_inode(fh->opened_file))
+#endif
+      )
+    return;
+  length = file_length(fh->opened_file);
+  if (length == 0)
+    return;
+
+  mh = mmap_create(cur, fh->opened_file, 0, addr, length,
+                   DIV_ROUND_UP(length, PGSIZE), true, false);
+  if (mh != NULL)
+  {
+    mh->mapid = cur->next_mapid++;
+    f->eax = (uint32_t) mh->mapid;
+  }
+}
+
+static void
+syscall_munmap(struct intr_frame *f UNUSED, mapid_t mapid)
+{
+  struct thread *cur = thread_current();
+  struct list_elem *e;
+
+  for (e = list_begin(&cur->mmap_list); e != list_end(&cur->mmap_list);
+       e = list_next(e))
+  {
+    struct mmap_handler *mh = list_entry(e, struct mmap_handler, elem);
+    if (mh->mapid == mapid && !mh->is_static_data)
+    {
+      list_remove(e);
+      mmap_unmap(cur, mh);
+      return;
+    }
+  }
+}
+
+static void
+syscall_fork(struct intr_frame *f)
+{
+  f->eax = (uint32_t) process_fork(f);
+}
+
+/* Returns whether the NUM_PAGE pages from VADDR are all free for
+   a mapping in CUR's address space. */
+bool
+mmap_check_mmap_vaddr(struct thread *cur, const void *vaddr, int num_page)
+{
+  int i;
+
+  for (i = 0; i < num_page; i++)
+    if (!page_available_upage(cur->page_table, (void *) vaddr + i * PGSIZE))
+      return false;
+  return true;
+}
+
+/* Enters every page of MH into CUR's supplemental page table, to
+   be read in when first touched.  Takes the pages out again and
+   returns false if memory runs out. */
+bool
+mmap_install_page(struct thread *cur, struct mmap_handler *mh)
+{
+  int i;
+
+  for (i = 0; i < mh->num_page; i++)
+    if (!page_install_file(cur->page_table, mh, mh->mmap_addr + i * PGSIZE))
+    {
+      while (i-- > 0)
+        page_unmap(cur->page_table, mh->mmap_addr + i * PGSIZE);
+      return false;
+    }
+  return true;
+}
+
+/* Returns how many bytes of the page at UPAGE in MH come from the
+   file. */
+size_t
+mmap_page_bytes(struct mmap_handler *mh, void *upage)
+{
+  uint32_t ofs = upage - mh->mmap_addr;
+
+  if (ofs >= mh->read_bytes)
+    return 0;
+  return mh->read_bytes - ofs < PGSIZE ? mh->read_bytes - ofs : PGSIZE;
+}
+
+/* Fills KPAGE with the page at UPAGE in MH. */
+void
+mmap_read_file(struct mmap_handler* mh, void *upage, void *kpage)
+{
+  size_t bytes = mmap_page_bytes(mh, upage);
+
+  if (bytes > 0)
+    file_read_at(mh->mmap_file, kpage, bytes,
+                 mh->file_ofs + (upage - mh->mmap_addr));
+  memset(kpage + bytes, 0, PGSIZE - bytes);
+}
+
+/* Writes the page at UPAGE in MH, held in KPAGE, back to the
+   file.  Only the part backed by the file is written. */
+void
+mmap_write_file(struct mmap_handler* mh, void *upage, void *kpage)
+{
+  size_t bytes = mmap_page_bytes(mh, upage);
+
+  ASSERT(!mh->is_static_data);
+  if (bytes > 0)
+    file_write_at(mh->mmap_file, kpage, bytes,
+                  mh->file_ofs + (upage - mh->mmap_addr));
+}
+
+/* Maps a segment of an executable the way mmap maps a file, so
+   that its pages are read in only when first touched.  The last
+   ZERO_BYTES bytes are never read from the file: a page of them
+   is zeroed when touched, and pages wholly past READ_BYTES, such
+   as the bss, cost no disk access at all.  The mapping has no id
+   and is undone when the process exits. */
+bool
+mmap_load_segment(struct file *file, off_t ofs, uint8_t *upage,
+                  uint32_t read_bytes, uint32_t zero_bytes, bool writable)
+{
+  return mmap_create(thread_current(), file, ofs, upage, read_bytes,
+                     (read_bytes + zero_bytes) / PGSIZE, writable,
+                     true) != NULL;
+}
+
+/* Maps NUM_PAGE pages at ADDR in CUR's address space to FILE,
+   starting at offset OFS, of which READ_BYTES bytes come from the
+   file.  The mapping gets its own handle on FILE.  Returns the
+   new mapping, in CUR's mmap_list, or NULL if the pages are not
+   all free or memory runs out. */
+static struct mmap_handler *
+mmap_create(struct thread *cur, struct file *file, off_t ofs, void *addr,
+            uint32_t read_bytes, int num_page, bool writable,
+            bool is_static_data)
+{
+  struct mmap_handler *mh;
+
+  if (!mmap_check_mmap_vaddr(cur, addr, num_page))
+    return NULL;
+  mh = malloc(sizeof *mh);
+  if (mh == NULL)
+    return NULL;
+  mh->mmap_file = file_reopen(file);
+  if (mh->mmap_file == NULL)
+  {
+    free(mh);
+    return NULL;
+  }
+  mh->mapid = -1;
+  mh->file_ofs = ofs;
+  mh->mmap_addr = addr;
+  mh->num_page = num_page;
+  mh->read_bytes = read_bytes;
+  mh->writable = writable;
+  mh->is_static_data = is_static_data;
+  if (!mmap_install_page(cur, mh))
+  {
+    file_close(mh->mmap_file);
+    free(mh);
+    return NULL;
+  }
+  list_push_back(&cur->mmap_list, &mh->elem);
+  return mh;
+}
+
+/* Gives the current process, being forked from PARENT, the same
+   segments as PARENT, their pages not read in yet; page_fork then
+   copies what PARENT has of them.  Files mapped by mmap are not
+   inherited.  Returns false if memory runs out. */
+bool
+mmap_fork(struct thread *parent)
+{
+  struct thread *cur = thread_current();
+  struct list_elem *e;
+
+  for (e = list_begin(&parent->mmap_list); e != list_end(&parent->mmap_list);
+       e = list_next(e))
+  {
+    struct mmap_handler *mh = list_entry(e, struct mmap_handler, elem);
+    if (mh->is_static_data
+        && mmap_create(cur, mh->mmap_file, mh->file_ofs, mh->mmap_addr,
+                       mh->read_bytes, mh->num_page, mh->writable,
+                       true) == NULL)
+      return false;
+  }
+  return true;
+}
+
+/* Unmaps all the files and segments CUR has mapped, writing back
+   the file pages it modified.  Used when the process exits. */
+void
+mmap_unmap_all(struct thread *cur)
+{
+  while (!list_empty(&cur->mmap_list))
+  {
+    struct mmap_handler *mh = list_entry(list_pop_front(&cur->mmap_list),
+                                         struct mmap_handler, elem);
+    mmap_unmap(cur, mh);
+  }
+}
+
+/* Removes the pages of MH from CUR's address space, writing back
+   the ones that were modified, then frees MH. */
+static void
+mmap_unmap(struct thread *cur, struct mmap_handler *mh)
+{
+  int i;
+
+  for (i = 0; i < mh->num_page; i++)
+    page_unmap(cur->page_table, mh->mmap_addr + i * PGSIZE);
+  file_close(mh->mmap_file);
+  free(mh);
+}
+
+#endif
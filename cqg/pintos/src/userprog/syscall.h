@@ -4,11 +4,37 @@
 #include <threads/thread.h>
 #include <lib/string.h>
 #include "lib/stddef.h"
+
+#ifdef VM
+#include "filesys/off_t.h"
+
+/* A file mapped into user memory by mmap, or a segment of the
+   executable.  Its pages are read from the file when first
+   touched; pages past READ_BYTES read as zeros. */
+struct mmap_handler
+  {
+    int mapid;                  /* Mapping id, -1 for a segment. */
+    struct file *mmap_file;     /* File the pages come from. */
+    off_t file_ofs;             /* File offset of the first page. */
+    void *mmap_addr;            /* First user page. */
+    int num_page;               /* Number of pages mapped. */
+    uint32_t read_bytes;        /* Bytes backed by the file. */
+    bool writable;              /* Whether the user may write the pages. */
+    bool is_static_data;        /* Segment: evicted to swap, never
+                                   written back to the file. */
+    struct list_elem elem;      /* Element in thread's mmap_list. */
+  };
+
 bool mmap_check_mmap_vaddr(struct thread *cur, const void *vaddr, int num_page);
 bool mmap_install_page(struct thread *cur, struct mmap_handler *mh);
+size_t mmap_page_bytes(struct mmap_handler *mh, void *upage);
 void mmap_read_file(struct mmap_handler* mh, void *upage, void *kpage);
 void mmap_write_file(struct mmap_handler* mh, void *upage, void *kpage);
 bool mmap_load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t read_bytes, uint32_t zero_bytes, bool writable);
+void mmap_unmap_all(struct thread *cur);
+bool mmap_fork(struct thread *parent);
+void syscall_unpin_all(void);
+#endif
 
 void syscall_file_close(struct file* file);
 struct file* syscall_file_open(const char* name);
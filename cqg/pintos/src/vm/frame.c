@@ -20,188 +20,562 @@
 
 
 
-static struct hash frame_table;
+//the reclaimer refills the pool up to FRAME_POOL_HIGH frames
+//once a fault finds fewer than FRAME_POOL_LOW in it
+#define FRAME_POOL_LOW  4
+#define FRAME_POOL_HIGH 16
+
+//one frame_item per page of the user pool, by page number in the pool
+static struct frame_item *frame_table;
+static uint8_t *frame_base;
+static size_t frame_cnt;
+static struct hash share_table;         //shared frames, by inode and ofs
+static struct condition share_loaded;   //a shared frame was read in
 static struct list frame_clock_list;
 static struct lock all_lock;
-//static struct lock frame_lock, frame_clock_lock;
 struct frame_item* current_frame;
 
-
-void* frame_get_used_frame(void *upage);
+//frames evicted ahead of time, handed out when the user pool is empty
+static void *frame_pool[FRAME_POOL_HIGH];
+static size_t frame_pool_cnt;
+static struct semaphore reclaim_sema;
+static bool reclaim_pending;
+
+
+static void* frame_alloc(enum palloc_flags flag);
+static void* frame_evict(void);
+static struct frame_item *frame_pick_victim(struct page_table_elem **e, index_t *slot);
+static bool frame_test_and_clear_accessed(struct frame_item *t);
+static bool frame_lock_mappers(struct frame_item *t);
+static void frame_unlock_mappers(struct frame_item *t);
+static void frame_unpin(struct frame_item *t);
+static void frame_clock_remove(struct frame_item *t);
+static void frame_drop_rmap(struct frame_item *t);
+static void frame_reclaimer(void *aux UNUSED);
 void frame_current_clock_to_next();
 void frame_current_clock_to_prev();
+static void frame_track(void *frame, void *upage, bool prefetched);
+static struct frame_item *frame_slot(void *frame);
 
 
-static bool frame_hash_less(const struct hash_elem *a,
+static bool frame_share_less(const struct hash_elem *a,
                      const struct hash_elem *b,
                      void *aux UNUSED);
-static unsigned frame_hash(const struct hash_elem *e,
+static unsigned frame_share_hash(const struct hash_elem *e,
                     void* aux UNUSED);
 
 
 void frame_init(){
-  hash_init(&frame_table, frame_hash, frame_hash_less, NULL);
+  size_t i;
+
+  frame_base = palloc_user_pool(&frame_cnt);
+  frame_table = calloc(frame_cnt, sizeof *frame_table);
+  if (frame_table == NULL)
+    PANIC("frame table creation failed");
+  for (i = 0; i < frame_cnt; i++){
+    frame_table[i].frame = frame_base + i * PGSIZE;
+    list_init(&frame_table[i].rmaps);
+  }
+  hash_init(&share_table, frame_share_hash, frame_share_less, NULL);
+  cond_init(&share_loaded);
   list_init(&frame_clock_list);
-//  lock_init(&frame_clock_lock);
-//  lock_init(&frame_lock);
   lock_init(&all_lock);
   current_frame = NULL;
+  frame_pool_cnt = 0;
+  sema_init(&reclaim_sema, 0);
+  reclaim_pending = false;
+  thread_create("reclaimer", PRI_DEFAULT, frame_reclaimer, NULL);
 }
 
 void *frame_get_frame(enum palloc_flags flag, void *upage) {
-//  ASSERT(thread == thread_current());
-//  printf("%d, lock0\n", thread_current()->tid);
   lock_acquire(&all_lock);
 
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (is_user_vaddr (upage));
 
-  void *frame = palloc_get_page(PAL_USER | flag);
+  void *frame = frame_alloc(flag);
+
+  if (frame == NULL){
+    lock_release(&all_lock);
+    return NULL;
+  }
+
+  frame_track(frame, upage, false);
 
+  lock_release(&all_lock);
+
+  return frame;
+}
+
+//take a page from the user pool, else from the reclaimer's pool, else
+//evict one.  flag is used by palloc_get_page
+//must be called with all_lock held, which eviction drops in between
+static void *frame_alloc(enum palloc_flags flag){
+  void *frame = palloc_get_page(PAL_USER | flag);
 
   if (frame == NULL){
-    frame = frame_get_used_frame(upage);
-    if (flag & PAL_ZERO)
+    if (frame_pool_cnt > 0)
+      frame = frame_pool[--frame_pool_cnt];
+    else
+      frame = frame_evict();
+    if (frame_pool_cnt < FRAME_POOL_LOW && !reclaim_pending){
+      reclaim_pending = true;
+      sema_up(&reclaim_sema);
+    }
+    if (frame != NULL && (flag & PAL_ZERO))
       memset (frame, 0, PGSIZE);
-    if (flag & PAL_ASSERT)
+    if (frame == NULL && (flag & PAL_ASSERT))
       PANIC ("frame_get: out of pages");
   }
+  return frame;
+}
 
-  if (frame == NULL){
-    lock_release(&all_lock);
+void *frame_get_shared(struct inode *inode, off_t ofs, size_t read_bytes,
+                       void *upage, bool *fresh){
+  struct frame_item key, *t;
+  struct frame_rmap *r;
+  struct hash_elem *e;
+  void *frame = NULL;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (inode != NULL);
+
+  r = malloc(sizeof *r);
+  if (r == NULL)
     return NULL;
+  r->t = thread_current();
+  r->upage = upage;
+  key.inode = inode;
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  lock_acquire(&all_lock);
+  //eviction may let somebody else bring the page in meanwhile
+  while ((e = hash_find(&share_table, &key.share_elem)) == NULL
+         && frame == NULL){
+    frame = frame_alloc(0);
+    if (frame == NULL){
+      lock_release(&all_lock);
+      free(r);
+      return NULL;
+    }
   }
 
-  ASSERT(pg_ofs(frame) == 0);
-  struct frame_item* tmp = (struct frame_item*)malloc(sizeof (struct frame_item));
-  tmp->frame = frame;
-  tmp->upage = upage;
-  tmp->t = thread_current();
-  tmp->pinned = true;
-//  lock_acquire(&frame_lock);
-  hash_insert(&frame_table, &tmp->hash_elem);
-//  lock_release(&frame_lock);
+  if (e != NULL){
+    if (frame != NULL)
+      palloc_free_page(frame);
+    t = hash_entry(e, struct frame_item, share_elem);
+    if (t->pin_cnt++ == 0)
+      frame_clock_remove(t);
+    list_push_back(&t->rmaps, &r->elem);
+    while (t->loading)
+      cond_wait(&share_loaded, &all_lock);
+    *fresh = false;
+  }
+  else{
+    frame_track(frame, NULL, false);
+    t = frame_lookup(frame);
+    t->t = NULL;
+    t->inode = inode;
+    t->ofs = ofs;
+    t->read_bytes = read_bytes;
+    t->loading = true;
+    list_push_back(&t->rmaps, &r->elem);
+    hash_insert(&share_table, &t->share_elem);
+    *fresh = true;
+  }
+  frame = t->frame;
+  lock_release(&all_lock);
+  return frame;
+}
 
+void frame_share_loaded(void *frame){
+  lock_acquire(&all_lock);
+  struct frame_item* t = frame_lookup(frame);
+  ASSERT(t != NULL && t->inode != NULL && t->loading);
+  t->loading = false;
+  cond_broadcast(&share_loaded, &all_lock);
   lock_release(&all_lock);
-//  printf("unlock0\n");
+}
+
+void *frame_try_get_frame(void *upage){
+  lock_acquire(&all_lock);
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
 
-//  frame_set_pinned_false(frame);
-//  printf("get_frame:%p\n", frame);
+  void *frame = palloc_get_page(PAL_USER);
+  if (frame != NULL)
+    frame_track(frame, upage, true);
+
+  lock_release(&all_lock);
   return frame;
 }
 
+//mark the entry of frame used and pinned, mapped from upage of the
+//current thread
+static void frame_track(void *frame, void *upage, bool prefetched){
+  ASSERT(pg_ofs(frame) == 0);
+  struct frame_item* tmp = frame_slot(frame);
+  ASSERT(tmp != NULL && !tmp->used && list_empty(&tmp->rmaps));
+  tmp->used = true;
+  tmp->upage = upage;
+  tmp->t = thread_current();
+  tmp->pin_cnt = 1;
+  tmp->evicting = false;
+  tmp->prefetched = prefetched;
+  tmp->inode = NULL;
+  tmp->loading = false;
+}
+
 void frame_free_frame(void *frame){
-//  printf("%d, lock1\n", thread_current()->tid);
   lock_acquire(&all_lock);
 
   struct frame_item* t = frame_lookup(frame);
 
   if (t == NULL)
     PANIC("try_free_a frame_that_not_exist!!");
-  if (!t->pinned){
-//    lock_acquire(&frame_clock_lock);
-    if (current_frame == t){
-      if (list_empty(&frame_clock_list))
-        current_frame = NULL;
-      else
-        frame_current_clock_to_next();
+  ASSERT(!t->evicting);
+  if (!list_empty(&t->rmaps)){
+    //drop the mapping of the current thread, and the frame with the last one
+    frame_drop_rmap(t);
+    if (!list_empty(&t->rmaps)){
+      lock_release(&all_lock);
+      return;
     }
-    list_remove(&t->list_elem);
-//    lock_release(&frame_clock_lock);
+    if (t->inode != NULL)
+      hash_delete(&share_table, &t->share_elem);
+  }
+  if (t->pin_cnt == 0){
+    frame_clock_remove(t);
   }
-//  printf("haha\n");
 
-//  lock_acquire(&frame_lock);
-  hash_delete(&frame_table, &t->hash_elem);
-//  lock_release(&frame_lock);
-  free(t);
-//  printf("free:%p\n", frame);
+  t->used = false;
   palloc_free_page(frame);
 
   lock_release(&all_lock);
-//  printf("unlock1\n");
 }
 
 bool frame_get_pinned(void* frame){
   struct frame_item* t = frame_lookup(frame);
   if (t == NULL)
     PANIC("try_set_pinned_of_a frame_that_not_exist!!");
-  return t->pinned;
+  return t->pin_cnt > 0;
 }
 
 bool frame_set_pinned_false(void* frame){
-//  printf("lock2\n");
   lock_acquire(&all_lock);
 
-
   struct frame_item* t = frame_lookup(frame);
   if (t == NULL){
     lock_release(&all_lock);
-//    printf("unlock2\n");
     return false;
   }
 
-  if (t->pinned == false){
+  if (t->pin_cnt == 0){
     lock_release(&all_lock);
-//    printf("unlock2\n");
     return true;
   }
 
-  t->pinned = false;
-//  lock_acquire(&frame_clock_lock);
-  list_push_back(&frame_clock_list, &t->list_elem);
-  if (list_size(&frame_clock_list) == 1)
-    current_frame = t;
-//  lock_release(&frame_clock_lock);
+  frame_unpin(t);
 
   lock_release(&all_lock);
-//  printf("unlock2\n");
   return true;
 }
 
-void* frame_get_used_frame(void *upage){
-  ASSERT(current_frame != NULL);
-//  lock_acquire(&frame_clock_lock);
-
-/*
-  struct page_table_elem *e = page_find(current_frame->t->page_table, current_frame->upage);
-  ASSERT( e != NULL && e->status == FRAME);
-*/  
-  while(pagedir_is_accessed(current_frame->t->pagedir, current_frame->upage)){
-    pagedir_set_accessed(current_frame->t->pagedir, current_frame->upage, false);
-    frame_current_clock_to_next();
-    ASSERT( current_frame != NULL );
+void frame_set_pinned_true(void* frame){
+  lock_acquire(&all_lock);
+  struct frame_item* t = frame_lookup(frame);
+  ASSERT(t != NULL);
+  if (t->pin_cnt++ == 0)
+    frame_clock_remove(t);
+  lock_release(&all_lock);
+}
+
+bool frame_fork_share(void *frame, struct thread *child, void *upage){
+  struct frame_rmap *own = NULL, *r = malloc(sizeof *r);
+  struct frame_item *t;
+
+  lock_acquire(&all_lock);
+  t = frame_lookup(frame);
+  ASSERT(t != NULL && t->inode == NULL);
+  if (list_empty(&t->rmaps) && (own = malloc(sizeof *own)) == NULL){
+    lock_release(&all_lock);
+    free(r);
+    return false;
+  }
+  if (r == NULL){
+    lock_release(&all_lock);
+    free(own);
+    return false;
   }
-  struct frame_item* t = current_frame;
-  void* tmp_frame = t->frame;
-//  printf("swap_free:%p, %p\n", current_frame->upage, current_frame->frame);
-  index_t index = (index_t)-1;
-//  struct page_table_elem* tmp = page_find(current_frame->t->page_table, current_frame->upage);
-//  struct thread* cur = thread_current();
-  ASSERT(page_find(current_frame->t->page_table, current_frame->upage) != NULL);
-  struct page_table_elem *e = page_find(current_frame->t->page_table, current_frame->upage); 
-  if (e == NULL || e->origin == NULL || ((struct mmap_handler *)(e->origin))->is_static_data){
-    index = swap_store(current_frame->frame);
-    if (index == -1)
+  if (own != NULL){
+    //the owner becomes the first of its mappings
+    own->t = t->t;
+    own->upage = t->upage;
+    list_push_back(&t->rmaps, &own->elem);
+    t->t = NULL;
+    t->upage = NULL;
+  }
+  r->t = child;
+  r->upage = upage;
+  list_push_back(&t->rmaps, &r->elem);
+  lock_release(&all_lock);
+  return true;
+}
+
+void *frame_cow_copy(void *frame, void *upage){
+  struct frame_item *t;
+  void *copy;
+
+  lock_acquire(&all_lock);
+  t = frame_lookup(frame);
+  ASSERT(t != NULL && t->inode == NULL && t->pin_cnt > 0);
+  if (list_size(&t->rmaps) > 1){
+    copy = frame_alloc(0);
+    //frame_alloc may drop all_lock to evict, and meanwhile the others
+    //may have made their own copies or gone; t stays put, being pinned
+    if (list_size(&t->rmaps) > 1){
+      if (copy != NULL){
+        memcpy(copy, frame, PGSIZE);
+        frame_drop_rmap(t);
+        frame_unpin(t);
+        frame_track(copy, upage, false);
+      }
+      lock_release(&all_lock);
+      return copy;
+    }
+    if (copy != NULL)
+      palloc_free_page(copy);
+  }
+
+  //the others are gone, the frame is ours alone again
+  frame_drop_rmap(t);
+  t->t = thread_current();
+  t->upage = upage;
+  lock_release(&all_lock);
+  return frame;
+}
+
+//remove the mapping of the current thread from the shared frame t
+//must be called with all_lock held
+static void frame_drop_rmap(struct frame_item *t){
+  struct list_elem *e;
+
+  for (e = list_begin(&t->rmaps); e != list_end(&t->rmaps); e = list_next(e)){
+    struct frame_rmap *r = list_entry(e, struct frame_rmap, elem);
+    if (r->t == thread_current()){
+      list_remove(e);
+      free(r);
+      return;
+    }
+  }
+  NOT_REACHED();
+}
+
+//evict one frame: the victim is chosen and unmapped under all_lock,
+//but written back to swap or its file after all_lock is released,
+//so that other allocations and frees don't wait for the disk.
+//meanwhile the frame is off the clock and marked evicting, and its
+//page is in transit, so neither its owner nor another evictor uses it
+//return the frame, now free for reuse, or NULL if none could be evicted
+//must be called with all_lock held, which is dropped in between
+static void* frame_evict(void){
+  struct page_table_elem *e;
+  index_t slot;
+  struct frame_item *t = frame_pick_victim(&e, &slot);
+  void *frame;
+
+  if (t == NULL)
+    return NULL;
+  if (!list_empty(&t->rmaps) && t->inode == NULL){
+    //copy-on-write frame: one swap slot, referred to by all its mappers
+    struct list_elem *l;
+    lock_release(&all_lock);
+    swap_write(slot, t->frame);
+    swap_dup(slot, list_size(&t->rmaps) - 1);
+    for (l = list_begin(&t->rmaps); l != list_end(&t->rmaps); l = list_next(l)){
+      struct frame_rmap *r = list_entry(l, struct frame_rmap, elem);
+      page_evict_end_cow(r->t, r->entry, (void *) slot);
+    }
+    lock_acquire(&all_lock);
+  }
+  else if (e != NULL){
+    bool freed;
+    lock_release(&all_lock);
+    freed = page_evict_end(t->t, e, t->frame);
+    lock_acquire(&all_lock);
+    if (!freed)   //swap is full, the page went back to its owner
       return NULL;
-    ASSERT(page_status_eviction(current_frame->t, current_frame->upage, index, true));
   }
+  if (t->inode != NULL)
+    hash_delete(&share_table, &t->share_elem);
+  while (!list_empty(&t->rmaps))
+    free(list_entry(list_pop_front(&t->rmaps), struct frame_rmap, elem));
+
+  frame = t->frame;
+  t->used = false;
+  return frame;
+}
+
+//drop one pin of t, putting it on the clock when none is left
+//must be called with all_lock held
+static void frame_unpin(struct frame_item *t){
+  ASSERT(t->pin_cnt > 0);
+  if (--t->pin_cnt > 0)
+    return;
+  t->evicting = false;
+  list_push_back(&frame_clock_list, &t->list_elem);
+  if (list_size(&frame_clock_list) == 1)
+    current_frame = t;
+}
+
+//run the clock hand to a frame that can be evicted, take it off the
+//clock and start evicting its page, whose entry is returned in *e
+//if it has to be written back, NULL otherwise
+//the page table locks of the victim's mappers are only tried: a mapper
+//may be faulting and waiting for all_lock itself.  a frame with a busy
+//mapper is passed over like a recently used one; two laps without a
+//victim give up
+//a shared frame loses all of its mappings at once.  a text frame is
+//read-only and read again from its file, so it never needs writing back.
+//a copy-on-write frame goes to a single swap slot, reserved here in
+//*slot, and each mapper's entry is kept in its frame_rmap
+//return NULL if no frame can be evicted
+//must be called with all_lock held
+static struct frame_item *frame_pick_victim(struct page_table_elem **e, index_t *slot){
+  struct frame_item *t = NULL;
+  size_t budget = 2 * list_size(&frame_clock_list) + 1;
+  bool cow;
+
+  if (current_frame == NULL)
+    return NULL;
+  while (budget-- > 0){
+    cow = !list_empty(&current_frame->rmaps) && current_frame->inode == NULL;
+    if (frame_test_and_clear_accessed(current_frame)){
+      if (current_frame->prefetched){
+        current_frame->prefetched = false;
+        swap_note_prefetch(true);
+      }
+    }
+    else if (frame_lock_mappers(current_frame)){
+      if (!cow)
+        *slot = (index_t)-1;
+      else if ((*slot = swap_alloc(list_entry(list_front(&current_frame->rmaps),
+                                              struct frame_rmap, elem)->t))
+               == (index_t)-1){
+        frame_unlock_mappers(current_frame);
+        return NULL;
+      }
+      t = current_frame;
+      break;
+    }
+    frame_current_clock_to_next();
+    ASSERT( current_frame != NULL );
+  }
+  if (t == NULL)
+    return NULL;
+
+  frame_clock_remove(t);
+  t->pin_cnt = 1;
+  t->evicting = true;
+  *e = NULL;
+  if (list_empty(&t->rmaps))
+    *e = page_evict_begin(t->t, t->upage);
   else{
-    mmap_write_file(e->origin, current_frame->upage, tmp_frame);
-    ASSERT(page_status_eviction(current_frame->t, current_frame->upage, index, false));
+    struct list_elem *l;
+    for (l = list_begin(&t->rmaps); l != list_end(&t->rmaps); l = list_next(l)){
+      struct frame_rmap *r = list_entry(l, struct frame_rmap, elem);
+      r->entry = page_evict_begin(r->t, r->upage);
+      ASSERT((r->entry == NULL) == (t->inode != NULL));
+    }
+  }
+  frame_unlock_mappers(t);
+
+  if (t->prefetched)
+    swap_note_prefetch(false);
+  return t;
+}
+
+//return whether any mapping of t was accessed since the last call
+static bool frame_test_and_clear_accessed(struct frame_item *t){
+  bool accessed = false;
+  struct list_elem *e;
+
+  if (list_empty(&t->rmaps)){
+    accessed = pagedir_is_accessed(t->t->pagedir, t->upage);
+    pagedir_set_accessed(t->t->pagedir, t->upage, false);
+    return accessed;
+  }
+  for (e = list_begin(&t->rmaps); e != list_end(&t->rmaps); e = list_next(e)){
+    struct frame_rmap *r = list_entry(e, struct frame_rmap, elem);
+    if (pagedir_is_accessed(r->t->pagedir, r->upage)){
+      accessed = true;
+      pagedir_set_accessed(r->t->pagedir, r->upage, false);
+    }
+  }
+  return accessed;
+}
+
+//try to take the page table locks of all the mappers of t
+//return false, holding none of them, if one is busy
+static bool frame_lock_mappers(struct frame_item *t){
+  struct list_elem *e, *f;
+
+  if (list_empty(&t->rmaps))
+    return !lock_held_by_current_thread(&t->t->page_table->lock)
+           && lock_try_acquire(&t->t->page_table->lock);
+  for (e = list_begin(&t->rmaps); e != list_end(&t->rmaps); e = list_next(e)){
+    struct lock *l = &list_entry(e, struct frame_rmap, elem)->t->page_table->lock;
+    if (lock_held_by_current_thread(l) || !lock_try_acquire(l)){
+      for (f = list_begin(&t->rmaps); f != e; f = list_next(f))
+        lock_release(&list_entry(f, struct frame_rmap, elem)->t->page_table->lock);
+      return false;
+    }
   }
+  return true;
+}
+
+//release the page table locks taken by frame_lock_mappers
+static void frame_unlock_mappers(struct frame_item *t){
+  struct list_elem *e;
+
+  if (list_empty(&t->rmaps)){
+    lock_release(&t->t->page_table->lock);
+    return;
+  }
+  for (e = list_begin(&t->rmaps); e != list_end(&t->rmaps); e = list_next(e))
+    lock_release(&list_entry(e, struct frame_rmap, elem)->t->page_table->lock);
+}
 
+//take t off the clock, moving the hand on if it points at t
+//must be called with all_lock held
+static void frame_clock_remove(struct frame_item *t){
+  if (current_frame == t){
+    if (list_size(&frame_clock_list) == 1)
+      current_frame = NULL;
+    else
+      frame_current_clock_to_next();
+  }
   list_remove(&t->list_elem);
-  if (list_empty(&frame_clock_list))
-    current_frame = NULL;
-  else
-    frame_current_clock_to_next();
-//  pagedir_clear_page(t->t->pagedir, t->upage);
-//  lock_acquire(&frame_lock);
-  hash_delete(&frame_table, &t->hash_elem);
-//  lock_release(&frame_lock);
-  free(t);
-  return tmp_frame;
+}
+
+//background thread keeping frame_pool filled, so that faults rarely
+//have to evict synchronously.  woken by frame_get_frame
+static void frame_reclaimer(void *aux UNUSED){
+  for (;;){
+    sema_down(&reclaim_sema);
+    lock_acquire(&all_lock);
+    while (frame_pool_cnt < FRAME_POOL_HIGH){
+      void *frame = frame_evict();
+      if (frame == NULL)
+        break;
+      frame_pool[frame_pool_cnt++] = frame;
+    }
+    reclaim_pending = false;
+    lock_release(&all_lock);
+  }
 }
 
 void frame_current_clock_to_next(){
@@ -231,22 +605,28 @@ void frame_current_clock_to_prev(){
 
 
 void *frame_lookup(void *frame){
-  struct frame_item p;
-  struct hash_elem * e;
-  p.frame = frame;
-//  lock_acquire(&frame_lock);
-  e = hash_find(&frame_table, &p.hash_elem);
-//  lock_release(&frame_lock);
-  return e == NULL? NULL : hash_entry(e, struct frame_item, hash_elem);
+  struct frame_item *t = frame_slot(frame);
+  return t != NULL && t->used ? t : NULL;
+}
+
+//the entry of frame, used or not; NULL if frame is not in the user pool
+static struct frame_item *frame_slot(void *frame){
+  size_t i = pg_no(frame) - pg_no(frame_base);
+  return i < frame_cnt ? &frame_table[i] : NULL;
 }
 
-static bool frame_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED){
-  const struct frame_item * ta = hash_entry(a, struct frame_item, hash_elem);
-  const struct frame_item * tb = hash_entry(b, struct frame_item, hash_elem);
-  return ta->frame < tb->frame;
+static bool frame_share_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED){
+  const struct frame_item * ta = hash_entry(a, struct frame_item, share_elem);
+  const struct frame_item * tb = hash_entry(b, struct frame_item, share_elem);
+  if (ta->inode != tb->inode)
+    return ta->inode < tb->inode;
+  if (ta->ofs != tb->ofs)
+    return ta->ofs < tb->ofs;
+  return ta->read_bytes < tb->read_bytes;
 }
 
-static unsigned frame_hash(const struct hash_elem *e, void* aux UNUSED){
-  struct frame_item* t = hash_entry(e, struct frame_item, hash_elem);
-  return hash_bytes(&t->frame, sizeof(t->frame));
+static unsigned frame_share_hash(const struct hash_elem *e, void* aux UNUSED){
+  struct frame_item* t = hash_entry(e, struct frame_item, share_elem);
+  return hash_bytes(&t->inode, sizeof(t->inode)) ^ hash_int(t->ofs)
+         ^ hash_int(t->read_bytes);
 }
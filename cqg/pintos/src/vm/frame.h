@@ -6,36 +6,94 @@
 #define MYPINTOS_FRAME_H
 
 #include "../lib/stdbool.h"
+#include "../lib/kernel/hash.h"
 #include "../threads/palloc.h"
+#include "../filesys/off_t.h"
 
+struct inode;
+
+//one mapping of a shared frame
+struct frame_rmap{
+    struct thread *t;
+    void *upage;
+    struct page_table_elem *entry;  //page table entry while being evicted
+    struct list_elem elem;
+};
+
+//the entry of a frame of the user pool, free while !used
 struct frame_item{
     void *frame;
-    void *upage;
+    bool used;
+    void *upage;        //mapping of a private frame, one with no rmaps
     struct thread* t;
-    bool pinned;
-    struct hash_elem hash_elem;
+    int pin_cnt;        //pinned while > 0, and then off the clock
+    bool evicting;      //being written back, off the clock and pinned
+    bool prefetched;    //read in by clustered swap-in, not yet touched
+    struct inode *inode;    //shared text frame: read-only page at ofs of
+    off_t ofs;              //inode; NULL for private and copy-on-write frames
+    size_t read_bytes;      //bytes of it read from inode, the rest zeroed
+    bool loading;           //shared text frame not read in yet
+    struct list rmaps;      //shared frame: its mappings, frame_rmaps
+    struct hash_elem share_elem;
     struct list_elem list_elem;
 };
 
 void *frame_lookup(void *frame);
 
-//init frame_table
+//init frame_table, with an entry for every page of the user pool
 //used in thread/init.c
 void  frame_init();
 
 //get a frame from user pool, which must be mapped from upage
 //in other words, in page_table, upage->frame_get_frame(flag, upage)
 //flag is used by palloc_get_page
+//when the user pool is empty, a frame is taken from the reclaimer's
+//pool, or else a page is evicted
 void* frame_get_frame(enum palloc_flags flag, void *upage);
 
+//like frame_get_frame, but only takes a free frame and never evicts
+//return NULL when the user pool is empty
+//used for pages read in ahead of a fault, which are marked prefetched
+void* frame_try_get_frame(void *upage);
+
+//get the frame holding the page at ofs of inode, shared by every process
+//mapping that page read-only, and add upage of the current thread to its
+//mappings.  the page is read_bytes bytes of inode, zero-filled past them:
+//segments that are not page-aligned in the file may map the same file
+//page with different tails, which are different pages.
+//if the frame is new, *fresh is set and the caller must read the page
+//into it and call frame_share_loaded; otherwise it is already read in.
+//the frame is returned pinned
+void* frame_get_shared(struct inode *inode, off_t ofs, size_t read_bytes,
+                       void *upage, bool *fresh);
+
+//tell the processes waiting in frame_get_shared that frame is read in
+void  frame_share_loaded(void *frame);
+
+//map frame, owned by the current thread, at upage of the forked child too
+//the two share it copy-on-write
+//return false if memory runs out
+bool  frame_fork_share(void *frame, struct thread *child, void *upage);
+
+//give the current thread a frame of its own for the copy-on-write frame
+//mapped at upage, which the caller has pinned with frame_set_pinned_true:
+//frame itself if no other process maps it any more, else a copy of it.
+//the result is pinned, NULL if memory runs out
+void* frame_cow_copy(void *frame, void *upage);
+
 //free a frame that got from frame_get_frame
+//a shared frame only loses the mapping of the current thread, and is
+//freed with its last mapping
 void  frame_free_frame(void *frame);
 
 //get pinned accord to frame
 //if a page is pinned, it won't be swaped to the disk
 bool  frame_get_pinned(void* frame);
 
-// set frame pinned to new_value
+// pin frame once more, taking it off the clock
+void frame_set_pinned_true(void* frame);
+
+// drop one pin of frame, putting it on the clock when none is left
 // return whether the set_pinned success
 bool frame_set_pinned_false(void* frame);
 
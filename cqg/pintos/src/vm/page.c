@@ -10,6 +10,7 @@
 #include "../threads/thread.h"
 #include "../userprog/pagedir.h"
 #include "../userprog/syscall.h"
+#include "../filesys/file.h"
 #include "../lib/stddef.h"
 #include "../threads/malloc.h"
 #include "../lib/debug.h"
@@ -30,11 +31,13 @@ unsigned page_hash(const struct hash_elem *e,
 void page_destroy_frame_likes(struct hash_elem *e,
 							void *aux UNUSED);
 
-static struct lock page_lock;
+static void page_swap_in(struct thread *cur, struct page_table_elem *t, void *dest);
+static struct page_table_elem *page_find_settled(page_table_t *page_table, void *upage);
+static void page_settle(page_table_t *page_table, struct page_table_elem *t);
+static bool page_shareable(struct page_table_elem *t);
+static void *page_get_shared(struct page_table_elem *t);
+static bool page_cow_break(struct thread *cur, struct page_table_elem *t);
 
-void page_lock_init() {
-	lock_init(&page_lock);
-}
 /* basic life cycle */
 page_table_t*
 page_create() {
@@ -56,15 +59,23 @@ page_create() {
 /* return whether page init is successful or not, btw, this function will create an initial virtual stack slot */
 bool
 page_init(page_table_t *page_table) {
-	return hash_init(page_table, page_hash, page_hash_less, NULL);
+	lock_init(&page_table->lock);
+	cond_init(&page_table->transit_done);
+	page_table->transit_cnt = 0;
+	return hash_init(&page_table->pages, page_hash, page_hash_less, NULL);
 }
 
-/* destroy page_table and recycle FRAME and SWAP slot */
+/* destroy page_table, recycle FRAME and SWAP slot and free the table itself */
 void
 page_destroy(page_table_t *page_table) {
-	lock_acquire(&page_lock);
-	hash_destroy(page_table, page_destroy_frame_likes);
-	lock_release(&page_lock);
+	lock_acquire(&page_table->lock);
+	while(page_table->transit_cnt > 0) {
+		cond_wait(&page_table->transit_done, &page_table->lock);
+	}
+	hash_destroy(&page_table->pages, page_destroy_frame_likes);
+	swap_release_cluster(thread_current());
+	lock_release(&page_table->lock);
+	free(page_table);
 }
 
 /* find the element with key = upage in page table*/
@@ -75,7 +86,7 @@ page_find(page_table_t *page_table, void *upage) {
 
     ASSERT(page_table != NULL);
 	tmp.key = upage;
-	e = hash_find(page_table, &(tmp.elem));
+	e = hash_find(&page_table->pages, &(tmp.elem));
 	
 	if(e != NULL) {
 		return hash_entry(e, struct page_table_elem, elem);
@@ -99,102 +110,275 @@ page_page_fault_handler(const void *vaddr, bool to_write, void *esp) {
 	page_table_t *page_table = cur->page_table;
 	uint32_t *pagedir = cur->pagedir;
 	void *upage = pg_round_down(vaddr);
-	
-	bool success = true;
-	lock_acquire(&page_lock);
-	
-	struct page_table_elem *t = page_find(page_table, upage);
-	void *dest = NULL;
-	
+	bool stack = upage >= PAGE_STACK_UNDERLINE && vaddr >= esp - PAGE_INST_MARGIN;
+	enum page_status from;
+	void *dest;
+
 	ASSERT(is_user_vaddr(vaddr));
-	ASSERT(!(t != NULL && t->status == FRAME));
-//	printf("vaddr:%p    esp:%p\n", vaddr, esp, PAGE_STACK_UNDERLINE);
-	if(to_write == true && t != NULL && t->writable == false)
-	  return false;
-		
-	if(upage >= PAGE_STACK_UNDERLINE) {
-		if(vaddr >= esp - PAGE_INST_MARGIN) {
-			if(t == NULL) {
-				dest = frame_get_frame(PAGE_PAL_FLAG, upage);
-				if(dest == NULL) {
-					success = false;
-				}
-				else {
-					t = malloc(sizeof(*t));
-					t->key = upage;
-					t->value = dest;
-					t->status = FRAME;
-					t->writable = true;
-					t->origin = NULL;
-					hash_insert(page_table, &t->elem);
-				}
-			}
-			else {
-				switch(t->status) {
-					case SWAP:
-						dest = frame_get_frame(PAGE_PAL_FLAG, upage);
-						if(dest == NULL) {
-							success = false;
-							break;
-						}
-						swap_load((index_t) t->value, dest);
-						t->value = dest;
-						t->status = FRAME;
-		  //            printf("swap :%d, %p->%p\n", cur->tid, t->key, t->value);
-						break;
-					default:
+
+	lock_acquire(&page_table->lock);
+	struct page_table_elem *t = page_find_settled(page_table, upage);
+
+	if(t == NULL) {
+		/* a new stack page */
+		if(!stack || (t = malloc(sizeof(*t))) == NULL) {
+			lock_release(&page_table->lock);
+			return false;
+		}
+		t->key = upage;
+		t->value = NULL;
+		t->status = FRAME;
+		t->writable = true;
+		t->cow = false;
+		t->origin = NULL;
+		hash_insert(&page_table->pages, &t->elem);
+	}
+	else if(t->status == FRAME && t->cow && to_write && t->writable) {
+		return page_cow_break(cur, t);
+	}
+	else if(t->status == FRAME || (to_write == true && t->writable == false)) {
+		lock_release(&page_table->lock);
+		return false;
+	}
+	from = t->status;
+
+	/* keep the entry to ourselves, but let go of the table while
+	   we wait for a frame and for the disk */
+	t->transit = PAGE_IN;
+	page_table->transit_cnt++;
+	lock_release(&page_table->lock);
+
+	if(from == FILE && page_shareable(t)) {
+		dest = page_get_shared(t);
+	}
+	else if((dest = frame_get_frame(PAGE_PAL_FLAG | (from == FRAME ? PAL_ZERO : 0), upage)) != NULL) {
+		switch(from) {
+			case SWAP:
+				page_swap_in(cur, t, dest);
+				break;
+			case FILE:
+				mmap_read_file(t->value, upage, dest);
+				break;
+			default:
+				break;
+		}
+	}
+
+	lock_acquire(&page_table->lock);
+	if(dest != NULL) {
+		t->value = dest;
+		t->status = FRAME;
+	}
+	else if(from == FRAME) {
+		hash_delete(&page_table->pages, &t->elem);
+	}
+	page_settle(page_table, t);
+	lock_release(&page_table->lock);
+
+	if(dest == NULL) {
+		if(from == FRAME) {
+			free(t);
+		}
+		return false;
+	}
+	ASSERT(pagedir_set_page(pagedir, t->key, t->value, t->writable));
+	frame_set_pinned_false(dest);
+	return true;
+}
+
 /*
-						printf("fuck\n");
-						printf("status:%s\n", t->status == FILE ? "FILE" : "FRAME");
+	make sure the page of vaddr is in a frame, writable if write is true,
+	and pin the frame so that it stays there until page_unpin.
+	a copy-on-write page is copied first even for reading: the frame
+	pinned must stay ours if a later pin of the same page writes it.
+	used by system calls before the kernel touches user memory, possibly
+	with file system locks held, where it must not fault.
+	return false if the page is not mapped, or read-only and write is true.
 */
-						success = false;
-				}
-			}
+bool
+page_pin(const void *vaddr, bool write, void *esp) {
+	struct thread *cur = thread_current();
+	page_table_t *page_table = cur->page_table;
+	void *upage = pg_round_down(vaddr);
+	struct page_table_elem *t;
+	bool cow;
+
+	for(;;) {
+		lock_acquire(&page_table->lock);
+		t = page_find_settled(page_table, upage);
+		if(t != NULL && write && !t->writable) {
+			lock_release(&page_table->lock);
+			return false;
 		}
-		else {
-			success = false;
+		cow = t != NULL && t->cow && t->writable;
+		if(t != NULL && t->status == FRAME && !cow) {
+			frame_set_pinned_true(t->value);
+			lock_release(&page_table->lock);
+			return true;
+		}
+		lock_release(&page_table->lock);
+
+		/* bring it in, or copy it if it is copy-on-write, and look again:
+		   it may be evicted before we get the lock back */
+		if(!page_page_fault_handler(vaddr, write || cow, esp)) {
+			return false;
 		}
 	}
+}
+
+/* drop the pin page_pin put on the frame of upage */
+void
+page_unpin(const void *upage) {
+	void *kpage = pagedir_get_page(thread_current()->pagedir, upage);
+
+	ASSERT(kpage != NULL);
+	frame_set_pinned_false(kpage);
+}
+
+/*
+	find the element with key = upage, waiting for it to settle if it is in transit.
+	must be called with the lock of page_table held.
+*/
+static struct page_table_elem *
+page_find_settled(page_table_t *page_table, void *upage) {
+	struct page_table_elem *t;
+
+	while((t = page_find(page_table, upage)) != NULL && t->transit != PAGE_SETTLED) {
+		cond_wait(&page_table->transit_done, &page_table->lock);
+	}
+	return t;
+}
+
+/*
+	mark t as no longer in transit and wake up whoever waits for it.
+	must be called with the lock of page_table held.
+*/
+static void
+page_settle(page_table_t *page_table, struct page_table_elem *t) {
+	ASSERT(t->transit != PAGE_SETTLED);
+	t->transit = PAGE_SETTLED;
+	page_table->transit_cnt--;
+	cond_broadcast(&page_table->transit_done, &page_table->lock);
+}
+
+/*
+	whether t is a read-only page of an executable, whose frame can be
+	shared by all the processes running it.
+*/
+static bool
+page_shareable(struct page_table_elem *t) {
+	struct mmap_handler *mh = t->origin;
+
+	return mh != NULL && mh->is_static_data && !t->writable;
+}
+
+/*
+	get the shared frame for FILE page t, keyed by the inode, offset and
+	length of the part of the file it comes from, reading it in only if no other process has it.
+	called without the page table lock, t being in transit.
+*/
+static void *
+page_get_shared(struct page_table_elem *t) {
+	struct mmap_handler *mh = t->origin;
+	off_t ofs = mh->file_ofs + (t->key - mh->mmap_addr);
+	bool fresh;
+	void *dest = frame_get_shared(file_get_inode(mh->mmap_file), ofs,
+	                              mmap_page_bytes(mh, t->key), t->key, &fresh);
+
+	if(dest != NULL && fresh) {
+		mmap_read_file(mh, t->key, dest);
+		frame_share_loaded(dest);
+	}
+	return dest;
+}
+
+/*
+	give the current process a frame of its own for the copy-on-write page
+	t, which it has written to, and map it writable.
+	called with the page table lock held, which is released.
+*/
+static bool
+page_cow_break(struct thread *cur, struct page_table_elem *t) {
+	page_table_t *page_table = cur->page_table;
+	void *old = t->value;
+	void *dest;
+
+	frame_set_pinned_true(old);
+	pagedir_clear_page(cur->pagedir, t->key);
+	t->transit = PAGE_IN;
+	page_table->transit_cnt++;
+	lock_release(&page_table->lock);
+
+	dest = frame_cow_copy(old, t->key);
+
+	lock_acquire(&page_table->lock);
+	if(dest != NULL) {
+		t->value = dest;
+		t->cow = false;
+	}
 	else {
-		if(t == NULL) {
-			success = false;
+		ASSERT(pagedir_set_page(cur->pagedir, t->key, old, false));
+	}
+	page_settle(page_table, t);
+	lock_release(&page_table->lock);
+
+	if(dest == NULL) {
+		frame_set_pinned_false(old);
+		return false;
+	}
+	ASSERT(pagedir_set_page(cur->pagedir, t->key, dest, true));
+	frame_set_pinned_false(dest);
+	return true;
+}
+
+/*
+	bring page t back from SWAP into frame dest.
+	the pages right above it whose slots follow its slot on disk were most
+	likely evicted together with it (see swap_store), so they are read in the
+	same disk request and mapped too, as long as free frames are at hand.
+	t is in transit and stays so; the neighbours are put in transit while the
+	disk reads them and settled here.  called without the page table lock.
+*/
+static void
+page_swap_in(struct thread *cur, struct page_table_elem *t, void *dest) {
+	page_table_t *page_table = cur->page_table;
+	struct page_table_elem *run[SWAP_RUN_MAX];
+	void *kpages[SWAP_RUN_MAX];
+	index_t index = (index_t) t->value;
+	size_t cnt, i;
+
+	run[0] = t;
+	kpages[0] = dest;
+	lock_acquire(&page_table->lock);
+	for(cnt = 1; cnt < SWAP_RUN_MAX; cnt++) {
+		struct page_table_elem *n = page_find(page_table, t->key + cnt * PGSIZE);
+		if(n == NULL || n->status != SWAP || n->transit != PAGE_SETTLED
+		   || (index_t) n->value != index + cnt * (PGSIZE / BLOCK_SECTOR_SIZE)) {
+			break;
 		}
-		else {
-			switch(t->status) {
-				case SWAP:
-					dest = frame_get_frame(PAGE_PAL_FLAG, upage);
-					if(dest == NULL) {
-						success = false;
-						break;
-					}
-					swap_load((index_t)t->value, dest);
-					t->value = dest;
-					t->status = FRAME;
-//                    printf("swap to frame:%d, %p->%p\n", cur->tid, t->key, t->value);
-					break;
-				case FILE:
-					dest = frame_get_frame(PAGE_PAL_FLAG, upage);
-					if(dest == NULL) {
-						success = false;
-						break;
-					}
-					mmap_read_file(t->value, upage, dest);
-					t->value = dest;
-					t->status = FRAME;
-//                    printf("file to frame:%d, %p->%p\n", cur->tid, t->key, t->value);
-					break;
-				default:
-					success = false;
-			}
+		kpages[cnt] = frame_try_get_frame(n->key);
+		if(kpages[cnt] == NULL) {
+			break;
 		}
+		n->transit = PAGE_IN;
+		page_table->transit_cnt++;
+		run[cnt] = n;
 	}
-	
-	frame_set_pinned_false(dest);
-	lock_release(&page_lock);
-	if(success) {
-		ASSERT(pagedir_set_page(pagedir, t->key, t->value, t->writable));
+	lock_release(&page_table->lock);
+
+	swap_load_run(index, cnt, kpages);
+
+	lock_acquire(&page_table->lock);
+	for(i = 1; i < cnt; i++) {
+		run[i]->value = kpages[i];
+		run[i]->status = FRAME;
+		page_settle(page_table, run[i]);
+	}
+	lock_release(&page_table->lock);
+	for(i = 1; i < cnt; i++) {
+		ASSERT(pagedir_set_page(cur->pagedir, run[i]->key, run[i]->value, run[i]->writable));
+		frame_set_pinned_false(run[i]->value);
 	}
-	return success;
 }
 
 /* Verify that there's not already a page at that virtual
@@ -205,24 +389,25 @@ bool page_set_frame(void *upage, void *kpage, bool wb) {
 	uint32_t *pagedir = cur->pagedir;
 
 	bool success = true;
-	lock_acquire(&page_lock);
+	lock_acquire(&page_table->lock);
 	
 	struct page_table_elem *t = page_find(page_table, upage);
-	if(t == NULL) {
-		t = malloc(sizeof(*t));
+	if(t == NULL && (t = malloc(sizeof(*t))) != NULL) {
 		t->key = upage;
 		t->value = kpage;
 		t->status = FRAME;
+		t->transit = PAGE_SETTLED;
 		t->origin = NULL;
 		t->writable = wb;
-		hash_insert(page_table, &t->elem);
+		t->cow = false;
+		hash_insert(&page_table->pages, &t->elem);
 //    printf("stack %p->%p\n", t->key, t->value);
 	}
 	else {
 		success = false;
 	}
 	
-	lock_release(&page_lock);
+	lock_release(&page_table->lock);
 	
 	if(success) {
 		ASSERT(pagedir_set_page(pagedir, t->key, t->value, t->writable));
@@ -242,91 +427,233 @@ bool page_accessible_upage(page_table_t *page_table, void *upage) {
 
 /* install file to page_table */
 bool page_install_file(page_table_t *page_table, struct mmap_handler *mh, void *key) {
-	struct thread *cur = thread_current();
+	struct page_table_elem *e;
 	bool success = true;
-	lock_acquire(&page_lock);
-	if(page_available_upage(page_table, key)) {
-		struct page_table_elem *e = malloc(sizeof(*e));
+	lock_acquire(&page_table->lock);
+	if(page_available_upage(page_table, key) && (e = malloc(sizeof(*e))) != NULL) {
 		e->key = key;
 		e->value = mh;
 		e->status = FILE;
+		e->transit = PAGE_SETTLED;
 		e->writable = mh->writable;
+		e->cow = false;
 		e->origin = mh;
-		hash_insert(page_table, &e->elem);
+		hash_insert(&page_table->pages, &e->elem);
 	}
 	else {
 		success = false;
 	}	
-	lock_release(&page_lock);
+	lock_release(&page_table->lock);
 	return success;
 }
 
-/* unmount a file */
+/* unmount a page of a file or of a segment, writing it back if it
+   belongs to a file and was modified */
 bool page_unmap(page_table_t *page_table, void *upage) {
 	struct thread *cur = thread_current();
 	bool success = true;
-	lock_acquire(&page_lock);
+	lock_acquire(&page_table->lock);
 	
-	if(page_accessible_upage(page_table, upage)) {
-		struct page_table_elem *t = page_find(page_table, upage);
-
-		ASSERT( t != NULL );
+	struct page_table_elem *t = page_find_settled(page_table, upage);
+	if(t != NULL && page_accessible_upage(page_table, upage)) {
 		switch(t->status) {
 			case FILE:
-				hash_delete(page_table, &(t->elem));
+				hash_delete(&page_table->pages, &(t->elem));
 				free(t);
 				break;
 			case FRAME:
-			    if(pagedir_is_dirty(cur->pagedir, t->key)) {
+			    if(!((struct mmap_handler *)(t->origin))->is_static_data
+			       && pagedir_is_dirty(cur->pagedir, t->key)) {
 			    	mmap_write_file(t->origin, t->key, t->value);
 			    }
 			    pagedir_clear_page(cur->pagedir, t->key);
-			    hash_delete(page_table, &(t->elem));
+			    hash_delete(&page_table->pages, &(t->elem));
          		frame_free_frame(t->value);
 			    free(t);
 			    break;
-			default:
-				success = false;
+			case SWAP:
+				/* a written page of a segment */
+				hash_delete(&page_table->pages, &(t->elem));
+				swap_free((index_t) t->value);
+				free(t);
+				break;
 		}
 		
 	}
 	else {
 		success = false;
 	}
-	lock_release(&page_lock);
+	lock_release(&page_table->lock);
 	return success;
 }
 
-/* switch a page from FRAME to SWAP */
-bool page_status_eviction(struct thread *cur, void *upage, void *index, bool to_swap) {
-	struct page_table_elem *t = page_find(cur->page_table, upage);
-    bool success = true;
-    
-	if(t != NULL && t->status == FRAME) {
-		if(to_swap) {
-			t->value = index;
-			t->status = SWAP;
+/*
+	start evicting upage of owner: unmap it and mark it on its way out, so
+	that owner waits for the write-back instead of touching the frame.
+	a mapped file page that was never written, or a read-only page of a
+	segment, needs no write-back and is switched to FILE right away, to be
+	read again from the file.  written pages of segments go to SWAP.
+	return the entry, which stays put until page_evict_end settles it,
+	or NULL if the frame is already free.
+	must be called with the lock of owner's page table held.
+*/
+struct page_table_elem *
+page_evict_begin(struct thread *owner, void *upage) {
+	struct page_table_elem *t = page_find(owner->page_table, upage);
+	struct mmap_handler *mh;
+	bool dirty;
+
+	ASSERT(t != NULL && t->status == FRAME && t->transit == PAGE_SETTLED);
+	mh = t->origin;
+	dirty = pagedir_is_dirty(owner->pagedir, upage);
+	pagedir_clear_page(owner->pagedir, upage);
+	if(mh != NULL && (mh->is_static_data ? !t->writable : !dirty)) {
+		t->value = mh;
+		t->status = FILE;
+		return NULL;
+	}
+	t->transit = PAGE_OUT;
+	owner->page_table->transit_cnt++;
+	return t;
+}
+
+/*
+	write the page of t, held in kpage, to SWAP or back to its file and
+	switch t over.  called without any lock, the entry being in transit.
+	if SWAP is full the page is mapped again and kpage goes back to owner.
+	return whether kpage can be reused.
+*/
+bool
+page_evict_end(struct thread *owner, struct page_table_elem *t, void *kpage) {
+	page_table_t *page_table = owner->page_table;
+	bool to_swap = t->origin == NULL || ((struct mmap_handler *)(t->origin))->is_static_data;
+	index_t index = (index_t) -1;
+
+	ASSERT(t->transit == PAGE_OUT);
+	if(to_swap) {
+		index = swap_store(kpage, owner);
+	}
+	else {
+		mmap_write_file(t->origin, t->key, kpage);
+	}
+
+	lock_acquire(&page_table->lock);
+	if(to_swap && index == (index_t) -1) {
+		ASSERT(pagedir_set_page(owner->pagedir, t->key, kpage, t->writable && !t->cow));
+		frame_set_pinned_false(kpage);
+	}
+	else if(to_swap) {
+		t->value = (void *) index;
+		t->status = SWAP;
+	}
+	else {
+		t->value = t->origin;
+		t->status = FILE;
+	}
+	page_settle(page_table, t);
+	lock_release(&page_table->lock);
+
+	return !to_swap || index != (index_t) -1;
+}
+
+/*
+	finish evicting page t of owner, one of the mappings of a copy-on-write
+	frame whose content has been written to the swap slot index, which all
+	of them now share.  called without any lock, the entry being in transit.
+*/
+void
+page_evict_end_cow(struct thread *owner, struct page_table_elem *t, void *index) {
+	page_table_t *page_table = owner->page_table;
+
+	ASSERT(t->transit == PAGE_OUT && t->cow);
+	lock_acquire(&page_table->lock);
+	t->value = index;
+	t->status = SWAP;
+	t->cow = false;
+	page_settle(page_table, t);
+	lock_release(&page_table->lock);
+}
+
+/*
+	copy the pages of parent into the page table of the current process,
+	its child being forked.  the mapped segments must have been copied
+	already (see mmap_fork), so that the child has their FILE entries.
+	pages in SWAP get one more reference to their slot; writable pages in
+	frames are shared copy-on-write, mapped read-only in both processes
+	until one of them writes; read-only ones are left to be read again,
+	or found in the share table.  mapped files are not inherited.
+	return false if memory runs out.
+*/
+bool
+page_fork(struct thread *parent) {
+	struct thread *cur = thread_current();
+	page_table_t *from = parent->page_table, *to = cur->page_table;
+	struct hash_iterator i;
+	bool success = true;
+
+	lock_acquire(&from->lock);
+	while(from->transit_cnt > 0) {
+		cond_wait(&from->transit_done, &from->lock);
+	}
+	lock_acquire(&to->lock);
+
+	hash_first(&i, &from->pages);
+	while(success && hash_next(&i)) {
+		struct page_table_elem *p = hash_entry(hash_cur(&i), struct page_table_elem, elem);
+		struct mmap_handler *mh = p->origin;
+		struct page_table_elem *c;
+
+		if(mh != NULL && !mh->is_static_data) {
+			continue;
+		}
+		if(mh != NULL) {
+			c = page_find(to, p->key);
+			ASSERT(c != NULL && c->status == FILE);
+		}
+		else if((c = malloc(sizeof(*c))) != NULL) {
+			*c = *p;
+			c->status = FILE;
+			hash_insert(&to->pages, &c->elem);
 		}
 		else {
-//            printf("frame to file :%d, %p->%p\n", cur->tid, t->value, t->origin);
-			ASSERT( t->origin != NULL );
-			t->value = t->origin;
-			t->status = FILE;
+			success = false;
+			break;
+		}
+
+		switch(p->status) {
+			case SWAP:
+				swap_dup((index_t) p->value, 1);
+				c->value = p->value;
+				c->status = SWAP;
+				break;
+			case FRAME:
+				if(mh != NULL && !p->writable) {
+					/* text, shared through its inode once faulted in */
+					break;
+				}
+				if(!frame_fork_share(p->value, cur, p->key)) {
+					success = false;
+					break;
+				}
+				/* the frame is shared from here on, even if mapping it
+				   into the child fails, whose exit then drops the rmap */
+				pagedir_set_writable(parent->pagedir, p->key, false);
+				p->cow = true;
+				c->value = p->value;
+				c->status = FRAME;
+				c->cow = true;
+				if(!pagedir_set_page(cur->pagedir, p->key, p->value, false)) {
+					success = false;
+				}
+				break;
+			case FILE:
+				break;
 		}
-		pagedir_clear_page(cur->pagedir, upage);
-	}
-	else {
-//	  printf("--%d, %p, %p, %d--", cur->tid, t, upage, ((struct mmap_handler*)t->origin)->is_static_data);
-	  if (t != NULL){
-	    printf("%s\n", t->status == FILE ? "flie" : "swap");
-	  }
-	  else
-	    puts("NULL");
-	  success = false;
 	}
 
+	lock_release(&to->lock);
+	lock_release(&from->lock);
 	return success;
-	
 }
 
 
@@ -359,10 +686,3 @@ void page_destroy_frame_likes(struct hash_elem *e, void *aux UNUSED) {
 	free(t);
 }
 
-
-struct page_table_elem* page_find_with_lock(page_table_t *page_table, void *upage){
-	lock_acquire(&page_lock);
-	struct page_table_elem* tmp = page_find(page_table, upage);
-	lock_release(&page_lock);
-	return tmp;
-}
\ No newline at end of file
@@ -24,8 +24,11 @@
 	if page ----> FILE, obtain a frame and fill it with FILESTREAM.
 	Return the frame to caller. 
 	
-	Parallelism seems has nothing to do with me, after all, one process(thread) can't make two page fault at the same time.
-	BUT FRAME and SWAP need it!
+	One process(thread) can't make two page faults at the same time, but other processes evict its frames
+	while it runs, so each page table has its own lock, and an entry whose page is being read in or written
+	out is marked in transit: the lock is not held across the I/O, and anybody who needs the entry waits
+	until it settles.
+	Faults of different processes take different locks and overlap their I/O.
 */
 
 #ifndef SUPPLEMENTAL_PAGE_TABLE_MODULE
@@ -35,7 +38,24 @@
 #include "../lib/kernel/hash.h"
 #include "../threads/palloc.h"
 #include "../threads/thread.h"
-typedef struct hash page_table_t;
+#include "../threads/synch.h"
+typedef struct page_table page_table_t;
+struct mmap_handler;
+
+/* supplemental page table of a process */
+struct page_table {
+	struct hash pages;				/* page_table_elems, by key */
+	struct lock lock;				/* protects PAGES and every entry in it */
+	struct condition transit_done;	/* signaled when an entry settles */
+	int transit_cnt;				/* entries in transit */
+};
+
+/* whether the page of an entry is on its way somewhere */
+enum page_transit {
+	PAGE_SETTLED,					/* not moving */
+	PAGE_IN,						/* being read into a frame */
+	PAGE_OUT						/* being written out of its frame */
+};
 
 enum page_status {
 	FRAME,
@@ -46,7 +66,10 @@ enum page_status {
 struct page_table_elem {
 	void *key, *value, *origin;
 	enum page_status status;
+	enum page_transit transit;
 	bool writable;
+	bool cow;						/* FRAME shared with a forked process, mapped
+									   read-only until written */
 	/*
 		key		:	virtual address of page
 		value	:	physical address of frame	status = FRAME
@@ -56,13 +79,11 @@ struct page_table_elem {
 	struct hash_elem elem;
 };
 
-void page_lock_init();
 /* basic life cycle */
 page_table_t *page_create();
 bool page_init(page_table_t *page_table);
 void page_destroy(page_table_t *page_table);
 struct page_table_elem* page_find(page_table_t *page_table, void *upage);
-struct page_table_elem* page_find_with_lock(page_table_t *page_table, void *upage);
 
 /* page fault handler */
 bool
@@ -72,8 +93,13 @@ page_page_fault_handler(const void *vaddr, bool to_write, void *esp);
 bool page_set_frame(void *upage, void *kpage, bool wb);
 bool page_available_upage(page_table_t *page_table, void *upage);
 bool page_install_file(page_table_t *page_table, struct mmap_handler *mh, void *key);
-bool page_status_eviction(struct thread *cur, void *upage, void *index, bool to_swap);
+struct page_table_elem *page_evict_begin(struct thread *owner, void *upage);
+bool page_evict_end(struct thread *owner, struct page_table_elem *t, void *kpage);
+void page_evict_end_cow(struct thread *owner, struct page_table_elem *t, void *index);
+bool page_fork(struct thread *parent);
 bool page_unmap(page_table_t *page_table, void *upage);
+bool page_pin(const void *vaddr, bool write, void *esp);
+void page_unpin(const void *upage);
 
 
 #endif
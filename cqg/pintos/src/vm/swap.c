@@ -4,104 +4,198 @@
 
 
 #include <lib/debug.h>
+#include <stdio.h>
 #include <threads/pte.h>
 #include <threads/malloc.h>
+#include <threads/interrupt.h>
+#include <threads/synch.h>
+#include <threads/thread.h>
 #include "swap.h"
-#include "../lib/kernel/hash.h"
+#include "../lib/kernel/bitmap.h"
 
 const int BLOCK_PER_PAGE = PGSIZE / BLOCK_SECTOR_SIZE;
 
+//number of page slots reserved for a process at a time
+//pages it evicts later land in the same run, so they can be read back together
+#define SWAP_CLUSTER 16
 
-struct swap_item{
-    index_t index;
-//    struct hash_elem hash_elem;
-    struct list_elem list_elem;
-};
-
-//struct hash swap_table;
-static struct list swap_free_list;
+//one bit per page slot, true = in use or reserved by some process's cluster
+static struct bitmap *swap_map;
+//number of page table entries referring to each slot in use
+//more than one after a slot is shared by fork
+static unsigned *swap_refcnt;
+static struct lock swap_lock;
 struct block* swap_block;
-index_t top_index = 0;
 
-index_t get_free_swap_slot();
-//bool swap_hash_less(const struct hash_elem *a,
-//                     const struct hash_elem *b,
-//                     void *aux UNUSED);
-//unsigned swap_hash(const struct hash_elem *e,
-//                    void* aux UNUSED);
+//statistics
+static long long swap_out_cnt;          //pages written to swap
+static long long swap_in_cnt;           //pages read back on a fault
+static long long swap_prefetch_cnt;     //neighbour pages read along with a fault
+static long long swap_prefetch_hit_cnt; //prefetched pages touched before eviction
+static long long swap_prefetch_wasted_cnt;  //prefetched pages evicted untouched
+
+static size_t swap_reserve_cluster(struct thread *owner);
+static void swap_reclaim_cluster(struct thread *t, void *aux);
+static void swap_unref(size_t slot);
 
 
 
 void swap_init(){
   swap_block = block_get_role(BLOCK_SWAP);
   ASSERT(swap_block != NULL);
-  list_init(&swap_free_list);
+  swap_map = bitmap_create(block_size(swap_block) / BLOCK_PER_PAGE);
+  swap_refcnt = calloc(bitmap_size(swap_map), sizeof *swap_refcnt);
+  if (swap_map == NULL || swap_refcnt == NULL)
+    PANIC("swap bitmap creation failed");
+  lock_init(&swap_lock);
 }
 
 
-index_t swap_store(void *kpage){
-  ASSERT(is_kernel_vaddr(kpage));
-  index_t index = get_free_swap_slot();
-  if (index == (index_t)-1)
-    return index;
-  for (int i = 0; i < BLOCK_PER_PAGE; i++){
-    block_write(swap_block, index + i, kpage + i * BLOCK_SECTOR_SIZE);
-  }
+index_t swap_store(void *kpage, struct thread *owner){
+  index_t index = swap_alloc(owner);
+
+  if (index != (index_t)-1)
+    swap_write(index, kpage);
   return index;
 }
 
+index_t swap_alloc(struct thread *owner){
+  size_t slot;
+
+  lock_acquire(&swap_lock);
+  if (owner->swap_next == owner->swap_end
+      && swap_reserve_cluster(owner) == 0){
+    lock_release(&swap_lock);
+    return (index_t)-1;
+  }
+  slot = owner->swap_next++;
+  swap_refcnt[slot] = 1;
+  swap_out_cnt++;
+  lock_release(&swap_lock);
+  return slot * BLOCK_PER_PAGE;
+}
+
+void swap_write(index_t index, void *kpage){
+  const void *bufs[PGSIZE / BLOCK_SECTOR_SIZE];
+
+  ASSERT(is_kernel_vaddr(kpage));
+  ASSERT(index % BLOCK_PER_PAGE == 0);
+  for (int i = 0; i < BLOCK_PER_PAGE; i++)
+    bufs[i] = kpage + i * BLOCK_SECTOR_SIZE;
+  block_write_multiple(swap_block, index, BLOCK_PER_PAGE, bufs);
+}
+
 void swap_load(index_t index, void *kpage){
+  swap_load_run(index, 1, &kpage);
+}
+
+void swap_load_run(index_t index, size_t cnt, void **kpages){
+  void *bufs[SWAP_RUN_MAX * (PGSIZE / BLOCK_SECTOR_SIZE)];
+  size_t i;
+
   ASSERT(index != (index_t)-1);
-  ASSERT(is_kernel_vaddr(kpage));
   ASSERT(index % BLOCK_PER_PAGE == 0);
+  ASSERT(cnt > 0 && cnt <= SWAP_RUN_MAX);
 
-  for (int i = 0; i < BLOCK_PER_PAGE; i++){
-    block_read(swap_block, index + i, kpage + i * BLOCK_SECTOR_SIZE);
+  for (i = 0; i < cnt; i++){
+    ASSERT(is_kernel_vaddr(kpages[i]));
+    for (int j = 0; j < BLOCK_PER_PAGE; j++)
+      bufs[i * BLOCK_PER_PAGE + j] = kpages[i] + j * BLOCK_SECTOR_SIZE;
   }
-  swap_free(index);
+  block_read_multiple(swap_block, index, cnt * BLOCK_PER_PAGE, bufs);
+
+  lock_acquire(&swap_lock);
+  for (i = 0; i < cnt; i++)
+    swap_unref(index / BLOCK_PER_PAGE + i);
+  swap_in_cnt++;
+  swap_prefetch_cnt += cnt - 1;
+  lock_release(&swap_lock);
 }
 
 void swap_free(index_t index){
   ASSERT(index % BLOCK_PER_PAGE == 0);
+  lock_acquire(&swap_lock);
+  swap_unref(index / BLOCK_PER_PAGE);
+  lock_release(&swap_lock);
+}
+
+void swap_dup(index_t index, size_t cnt){
+  size_t slot = index / BLOCK_PER_PAGE;
+
+  ASSERT(index % BLOCK_PER_PAGE == 0);
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(swap_map, slot));
+  swap_refcnt[slot] += cnt;
+  lock_release(&swap_lock);
+}
 
-  if (top_index == index + BLOCK_PER_PAGE)
-    top_index = index;
-  else{
-    struct swap_item* t = malloc(sizeof(struct swap_item));
-    t->index = index;
-    list_push_back(&swap_free_list, &t->list_elem);
-  }
+void swap_release_cluster(struct thread *owner){
+  lock_acquire(&swap_lock);
+  swap_reclaim_cluster(owner, NULL);
+  lock_release(&swap_lock);
 }
 
+void swap_note_prefetch(bool hit){
+  lock_acquire(&swap_lock);
+  if (hit)
+    swap_prefetch_hit_cnt++;
+  else
+    swap_prefetch_wasted_cnt++;
+  lock_release(&swap_lock);
+}
 
-index_t get_free_swap_slot(){
-  index_t res = (index_t)-1;
-  if (list_empty(&swap_free_list)){
-    if (top_index + BLOCK_PER_PAGE < block_size(swap_block)){
-      res = top_index;
-      top_index += BLOCK_PER_PAGE;
-    }
+void swap_print_stats(void){
+  printf("Swap: %lld pages out, %lld faults in; "
+         "clustered: %lld pages, %lld hits, %lld wasted\n",
+         swap_out_cnt, swap_in_cnt, swap_prefetch_cnt,
+         swap_prefetch_hit_cnt, swap_prefetch_wasted_cnt);
+}
+
+
+//give owner a fresh run of free slots, preferring the run right after
+//its previous cluster so that consecutive clusters stay contiguous.
+//falls back to smaller runs when swap is fragmented, and when not even
+//one slot is free, takes back the unused slots of every other cluster.
+//return the number of slots reserved, 0 if swap is full
+//must be called with swap_lock held
+static size_t swap_reserve_cluster(struct thread *owner){
+  size_t cnt, start;
+
+  if (bitmap_all(swap_map, 0, bitmap_size(swap_map))){
+    enum intr_level old_level = intr_disable();
+    thread_foreach(swap_reclaim_cluster, NULL);
+    intr_set_level(old_level);
   }
-  else{
-    struct swap_item* t = list_entry(list_front(&swap_free_list), struct swap_item, list_elem);
-    list_remove(&t->list_elem);
-    res = t->index;
-    free(t);
+
+  for (cnt = SWAP_CLUSTER; cnt > 0; cnt /= 2){
+    if (owner->swap_end != 0
+        && owner->swap_end + cnt <= bitmap_size(swap_map)
+        && bitmap_none(swap_map, owner->swap_end, cnt))
+      start = owner->swap_end;
+    else
+      start = bitmap_scan(swap_map, 0, cnt, false);
+    if (start != BITMAP_ERROR){
+      bitmap_set_multiple(swap_map, start, cnt, true);
+      owner->swap_next = start;
+      owner->swap_end = start + cnt;
+      return cnt;
+    }
   }
-  return res;
+  return 0;
 }
 
-//
-//
-//bool frame_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED){
-//  const struct swap_item * ta = hash_entry(a, struct swap_item, hash_elem);
-//  const struct swap_item * tb = hash_entry(b, struct swap_item, hash_elem);
-//  if (ta->pd == tb->pd)
-//    return ta->upage < tb->upage;
-//  return ta->pd < tb->pd;
-//}
-//
-//unsigned frame_hash(const struct hash_elem *e, void* aux UNUSED){
-//  struct swap_item* t = hash_entry(e, struct swap_item, hash_elem);
-//  return hash_bytes(&t->pd, sizeof(t->pd) + sizeof(t->upage));
-//}
+//give back the unused part of t's swap cluster, for thread_foreach()
+//must be called with swap_lock held
+static void swap_reclaim_cluster(struct thread *t, void *aux UNUSED){
+  bitmap_set_multiple(swap_map, t->swap_next, t->swap_end - t->swap_next,
+                      false);
+  t->swap_next = t->swap_end = 0;
+}
+
+//drop one reference to slot, freeing it with the last one
+//must be called with swap_lock held
+static void swap_unref(size_t slot){
+  ASSERT(bitmap_test(swap_map, slot) && swap_refcnt[slot] > 0);
+  if (--swap_refcnt[slot] == 0)
+    bitmap_reset(swap_map, slot);
+}
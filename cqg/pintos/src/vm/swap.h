@@ -10,22 +10,54 @@
 //identifier type of the swap slot
 typedef  block_sector_t index_t;
 
+//max number of pages read by one swap_load_run()
+#define SWAP_RUN_MAX 8
+
+struct thread;
 
 //initialize swap when kernel starts
 //used in thread/init.c
 void swap_init();
 
 //store the content of a kpage(frame) to a swap slot(on the disk)
+//slots are taken from a cluster reserved for owner, so the pages one
+//process evicts end up next to each other
 //return an identifier of the swap slot
-index_t swap_store(void *kpage);
+index_t swap_store(void *kpage, struct thread *owner);
+
+//the two halves of swap_store: take a slot from owner's cluster without
+//any I/O, so that it can be had while holding the frame lock, and fill it
+//return (index_t)-1 if swap is full
+index_t swap_alloc(struct thread *owner);
+void swap_write(index_t index, void *kpage);
 
 //load a swap slot to the kpage(frame)
 //index must be got from swap_store()
 void swap_load(index_t index, void *kpage);
 
+//load cnt consecutive swap slots starting at index into kpages[]
+//with a single disk request, then free the slots (drop one reference)
+//the first page is the one faulted on, the rest count as prefetched
+void swap_load_run(index_t index, size_t cnt, void **kpages);
+
 //free a swap slot whose identifier is index
 //index must be got from swap_store()
+//a slot shared by fork is only freed with its last reference
 void swap_free(index_t index);
 
+//add cnt references to the swap slot index, which then has to be
+//freed or loaded once more for each of them.  used by fork
+void swap_dup(index_t index, size_t cnt);
+
+//give back the unused part of owner's swap cluster
+//used when the process exits
+void swap_release_cluster(struct thread *owner);
+
+//record whether a prefetched page was touched before it was evicted
+void swap_note_prefetch(bool hit);
+
+//print swap statistics, used in devices/shutdown.c
+void swap_print_stats(void);
+
 
 #endif //MYPINTOS_SWAP_H